@@ -3,7 +3,8 @@ from rest_framework.decorators import action, api_view, permission_classes
 from rest_framework.response import Response
 from rest_framework.views import APIView
 from django.contrib.auth import get_user_model
-from monitoring.models import Lunchbox, SensorReading, Alert
+from monitoring.models import Lunchbox, SensorReading, SensorRollup, Alert
+from monitoring import retention, rollups
 from .serializers import (
     UserSerializer, LunchboxSerializer, SensorReadingSerializer,
     AlertSerializer
@@ -177,43 +178,41 @@ class DashboardStatsView(APIView):
     permission_classes = [permissions.IsAuthenticated]
     
     def get(self, request, format=None):
-        from django.db.models import Count, Avg, Q, F, Max, Min
+        from django.db.models import Count, Q, Sum
         from django.utils import timezone
         from datetime import timedelta
         
-        # Base querysets
+        # Base querysets (reading statistics come from the rollups, never the raw readings)
         lunchboxes = Lunchbox.objects.all()
-        sensor_readings = SensorReading.objects.all()
+        readings = SensorRollup.objects.all()
         alerts = Alert.objects.all()
         
         # Apply permission filtering
         if not request.user.is_staff:
             lunchboxes = lunchboxes.filter(owner=request.user)
-            sensor_readings = sensor_readings.filter(lunchbox__owner=request.user)
+            readings = readings.filter(lunchbox__owner=request.user)
             alerts = alerts.filter(lunchbox__owner=request.user)
         
-        # Get counts
+        # Get counts (readings: those still kept, in whole days from the retention cutoff on)
+        kept_since = rollups.floor_bucket(retention.cutoffs()[0], SensorRollup.DAY)
         stats = {
             'total_lunchboxes': lunchboxes.count(),
             'active_lunchboxes': lunchboxes.filter(is_active=True).count(),
-            'total_sensor_readings': sensor_readings.count(),
+            'total_sensor_readings': readings.filter(resolution=SensorRollup.DAY, bucket__gte=kept_since)
+                                             .aggregate(n=Sum('count'))['n'] or 0,
             'active_alerts': alerts.filter(is_resolved=False).count(),
         }
         
         # Get temperature statistics (last 24 hours)
-        twenty_four_hours_ago = timezone.now() - timedelta(hours=24)
-        recent_readings = sensor_readings.filter(timestamp__gte=twenty_four_hours_ago)
-        
-        if recent_readings.exists():
-            temp_stats = recent_readings.aggregate(
-                avg_temp=Avg('temperature'),
-                max_temp=Max('temperature'),
-                min_temp=Min('temperature')
-            )
+        now = timezone.now()
+        twenty_four_hours_ago = now - timedelta(hours=24)
+        temp_stats = rollups.summarize(readings.filter(sensor_type=SensorReading.TEMPERATURE),
+                                       twenty_four_hours_ago, now)
+        if temp_stats['count']:
             stats.update({
-                'avg_temperature': round(temp_stats['avg_temp'], 2) if temp_stats['avg_temp'] else None,
-                'max_temperature': round(temp_stats['max_temp'], 2) if temp_stats['max_temp'] else None,
-                'min_temperature': round(temp_stats['min_temp'], 2) if temp_stats['min_temp'] else None,
+                'avg_temperature': round(temp_stats['mean'], 2),
+                'max_temperature': round(temp_stats['max'], 2),
+                'min_temperature': round(temp_stats['min'], 2),
             })
         
         # Get alert statistics
@@ -247,31 +246,22 @@ class DashboardStatsView(APIView):
             for alert in recent_alerts
         ]
         
-        # Get sensor readings for the last 24 hours (for charts)
+        # Get sensor readings for the last 24 hours (for charts), one row per hour bucket
+        first_hour = rollups.floor_bucket(now, SensorRollup.HOUR) - timedelta(hours=23)
+        hours = {}
+        for r in rollups.bucket_series(readings, SensorRollup.HOUR, first_hour, now, by_type=True):
+            hours.setdefault(r['bucket'], {})[r['sensor_type']] = r
         time_series = []
-        for hour in range(24, 0, -1):
-            time_end = timezone.now() - timedelta(hours=hour-1)
-            time_start = time_end - timedelta(hours=1)
-            
-            hour_readings = recent_readings.filter(
-                timestamp__gte=time_start,
-                timestamp__lt=time_end
-            )
-            
-            if hour_readings.exists():
-                hour_stats = hour_readings.aggregate(
-                    avg_temp=Avg('temperature'),
-                    avg_humidity=Avg('humidity'),
-                    count=Count('id')
-                )
-                
-                time_series.append({
-                    'time': time_start.strftime('%H:%M'),
-                    'timestamp': time_start.isoformat(),
-                    'temperature': round(hour_stats['avg_temp'], 2) if hour_stats['avg_temp'] else None,
-                    'humidity': round(hour_stats['avg_humidity'], 2) if hour_stats['avg_humidity'] else None,
-                    'readings_count': hour_stats['count']
-                })
+        for bucket, by_type in sorted(hours.items()):
+            temp = by_type.get(SensorReading.TEMPERATURE)
+            humi = by_type.get(SensorReading.HUMIDITY)
+            time_series.append({
+                'time': timezone.localtime(bucket).strftime('%H:%M'),
+                'timestamp': bucket.isoformat(),
+                'temperature': round(temp['mean'], 2) if temp else None,
+                'humidity': round(humi['mean'], 2) if humi else None,
+                'readings_count': sum(r['count'] for r in by_type.values())
+            })
         
         stats['time_series'] = time_series
         
@@ -20,9 +20,9 @@ app.autodiscover_tasks(lambda: settings.INSTALLED_APPS)
 
 # Configure periodic tasks
 app.conf.beat_schedule = {
-    # Check for alerts every minute
-    'check-alerts-every-minute': {
-        'task': 'monitoring.tasks.check_for_alerts',
+    # Fold new readings into the dashboard rollups (monitoring/rollups.py)
+    'roll-up-readings': {
+        'task': 'monitoring.tasks.roll_up_readings',
         'schedule': 60.0,  # Every minute
     },
     # Clean up old data every day at midnight
@@ -247,6 +247,24 @@ else:
         },
     }
 
+# Cache: shared by every web, Celery and mqtt_ingest process. The device key cache, the
+# alert-rule state and the ingest load window (monitoring/) rely on that to see each other's
+# writes. USE_LOCMEM_CACHE=1 keeps a per-process cache for single-process development and
+# follows USE_INMEM_CHANNELS by default.
+if os.getenv('USE_LOCMEM_CACHE', os.getenv('USE_INMEM_CHANNELS', '1')) == '1':
+    CACHES = {
+        'default': {
+            'BACKEND': 'django.core.cache.backends.locmem.LocMemCache',
+        }
+    }
+else:
+    CACHES = {
+        'default': {
+            'BACKEND': 'django.core.cache.backends.redis.RedisCache',
+            'LOCATION': os.getenv('REDIS_URL', 'redis://localhost:6379/0'),
+        }
+    }
+
 # Logging
 LOGGING = {
     'version': 1,
@@ -271,3 +289,40 @@ LOGGING = {
 
 # Optional: shared secret header for device ingest hardening (set in .env)
 DEVICE_INGEST_SHARED_SECRET = os.getenv('DEVICE_INGEST_SHARED_SECRET', '').strip()
+
+# Async ingest: validate, queue the batch for the Celery 'monitoring' workers and reply 202.
+# Falls back to storing inline when the broker is unreachable.
+DEVICE_INGEST_ASYNC = os.getenv('DEVICE_INGEST_ASYNC', 'False') == 'True'
+
+# MQTT uplink (monitoring/mqtt.py, `manage.py mqtt_ingest`): broker the devices publish to
+MQTT_BROKER_HOST = os.getenv('MQTT_BROKER_HOST', 'localhost')
+MQTT_BROKER_PORT = int(os.getenv('MQTT_BROKER_PORT', '8883'))
+MQTT_USERNAME = os.getenv('MQTT_USERNAME', '')
+MQTT_PASSWORD = os.getenv('MQTT_PASSWORD', '')
+MQTT_TLS = os.getenv('MQTT_TLS', 'True') == 'True'
+MQTT_TOPIC_PREFIX = os.getenv('MQTT_TOPIC_PREFIX', 'lunchbox')
+
+# Device API key lookup cache (monitoring/auth_cache.py): per-process LRU in front of the
+# Django cache. Seconds; the local TTL bounds how long a revoked key lingers in other workers
+# (and is also the shared TTL when CACHES is the per-process LocMemCache).
+DEVICE_KEY_CACHE_TTL = int(os.getenv('DEVICE_KEY_CACHE_TTL', '300'))
+DEVICE_KEY_LOCAL_TTL = int(os.getenv('DEVICE_KEY_LOCAL_TTL', '30'))
+DEVICE_KEY_LOCAL_SIZE = int(os.getenv('DEVICE_KEY_LOCAL_SIZE', '4096'))
+
+# Ingest load shedding (monitoring/throttles.py IngestLoad). Capacity is fleet-wide POSTs per
+# second (counted in the shared cache) and in-flight POSTs per worker; from the soft level
+# replies ask devices for larger batches, at full load POSTs get 503 with Retry-After of about
+# INGEST_RETRY_AFTER_S. INGEST_WORKERS splits the capacity when the cache is per process.
+INGEST_CAPACITY_RATE = float(os.getenv('INGEST_CAPACITY_RATE', '200'))
+INGEST_MAX_INFLIGHT = int(os.getenv('INGEST_MAX_INFLIGHT', '16'))
+INGEST_SOFT_LOAD = float(os.getenv('INGEST_SOFT_LOAD', '0.7'))
+INGEST_RETRY_AFTER_S = int(os.getenv('INGEST_RETRY_AFTER_S', '5'))
+INGEST_WORKERS = int(os.getenv('INGEST_WORKERS', os.getenv('WEB_CONCURRENCY', '1')))
+
+# Retention (monitoring/retention.py, nightly cleanup-old-data task). Raw readings and 1-minute
+# rollups expire; hourly and daily rollups are kept. The chunked purge deletes
+# PURGE_CHUNK_SIZE rows at a time with PURGE_CHUNK_PAUSE seconds between chunks.
+READINGS_RETENTION_DAYS = int(os.getenv('READINGS_RETENTION_DAYS', '180'))
+ROLLUP_MINUTE_RETENTION_DAYS = int(os.getenv('ROLLUP_MINUTE_RETENTION_DAYS', '30'))
+PURGE_CHUNK_SIZE = int(os.getenv('PURGE_CHUNK_SIZE', '5000'))
+PURGE_CHUNK_PAUSE = float(os.getenv('PURGE_CHUNK_PAUSE', '0.1'))
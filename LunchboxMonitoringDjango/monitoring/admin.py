@@ -44,6 +44,12 @@ class LunchboxAdmin(admin.ModelAdmin):
             'fields': ('device_api_key',),
             'description': 'Share this key securely with the physical device; treat as a secret.'
         }),
+        ('Device Config', {
+            'fields': ('device_config',),
+            'description': 'JSON overrides of the default periods, channel policy, batching and alert '
+                           'thresholds; devices pick them up with their next upload.',
+            'classes': ('collapse',)
+        }),
         ('Timestamps', {
             'fields': ('created_at', 'updated_at'),
             'classes': ('collapse',)
@@ -0,0 +1,207 @@
+"""Alert rules engine.
+
+RULES declares every alert the server raises from readings. The numbers come from the
+lunchbox's config (device_config.py): ``alerts`` holds the thresholds the device also
+pre-filters with, and ``rules`` the server-side tuning, per alert type:
+
+- ``clear``: hysteresis band. An active alert clears only once the value is this far back
+  on the safe side of the threshold, so a value hovering at the threshold raises one alert;
+- ``debounce``: consecutive breaching readings needed to raise;
+- ``hold_s`` (motion): an active motion alert clears after this long without motion, so PIR
+  chatter within one episode is a single alert.
+
+Each lunchbox's open-alert state lives in the Django cache, shared by every ingest process
+(web workers, the ingest_batch task, mqtt_ingest), so evaluating a batch of readings
+normally runs no query. Alerts are written only on transitions: raised (created), escalated
+to a higher severity, cleared (resolved). On a cache miss the state is rebuilt from the
+lunchbox's unresolved alerts, one query.
+
+The state is stored under a per-lunchbox generation token. Changing an alert outside the
+engine (resolved by hand, deleted) replaces the token once that change commits, so every
+process rebuilds from the DB, and a batch evaluated against the old state can only write to
+the old key. The engine writes its own state after its transaction commits: a rolled-back
+ingest leaves nothing behind.
+"""
+import uuid
+from dataclasses import dataclass
+from datetime import timedelta
+from typing import Optional
+
+from django.core.cache import cache
+from django.db import transaction
+from django.utils import timezone
+
+from .device_config import effective_config
+from .models import Alert, SensorReading
+
+# Unresolved alerts older than this are not adopted into the state; the condition raises a fresh one
+RECENT_ALERT_WINDOW = timedelta(hours=72)
+STATE_TTL = 24 * 3600  # seconds; a lunchbox silent longer than this is rebuilt from the DB
+
+SEVERITY_RANK = {Alert.INFO: 0, Alert.WARNING: 1, Alert.CRITICAL: 2}
+
+ACTIVE = 'active'
+PENDING = 'pending'
+
+
+@dataclass(frozen=True)
+class Rule:
+    alert_type: str
+    sensor_type: str
+    threshold: Optional[str]  # key in the config's 'alerts'; None for motion (any positive value)
+    above: bool = True        # breach when value > threshold (False: value < threshold)
+    inclusive: bool = False   # breach at the threshold itself too
+    severity: str = Alert.WARNING
+    critical_margin: Optional[float] = None  # this far past the threshold is CRITICAL
+    message: str = ''
+
+    def breached(self, value, limit):
+        if self.threshold is None:
+            return value > 0
+        if self.above:
+            return value >= limit if self.inclusive else value > limit
+        return value <= limit if self.inclusive else value < limit
+
+    def cleared(self, value, limit, band):
+        if self.threshold is None:
+            return False  # motion clears on hold_s, not on value
+        return value < limit - band if self.above else value > limit + band
+
+    def severity_for(self, value, limit):
+        if self.critical_margin is not None and limit is not None:
+            past = value - limit if self.above else limit - value
+            if past >= self.critical_margin:
+                return Alert.CRITICAL
+        return self.severity
+
+
+RULES = (
+    Rule(Alert.TEMPERATURE_HIGH, SensorReading.TEMPERATURE, 'temp_high', critical_margin=5,
+         message='Temperature high: {v}{u} > {limit}°C'),
+    Rule(Alert.TEMPERATURE_LOW, SensorReading.TEMPERATURE, 'temp_low', above=False, severity=Alert.CRITICAL,
+         message='Temperature low: {v}{u} < {limit}°C'),
+    Rule(Alert.HUMIDITY_HIGH, SensorReading.HUMIDITY, 'humi_high',
+         message='Humidity high: {v}{u} > {limit}%'),
+    Rule(Alert.HUMIDITY_LOW, SensorReading.HUMIDITY, 'humi_low', above=False,
+         message='Humidity low: {v}{u} < {limit}%'),
+    Rule(Alert.GAS_HIGH, SensorReading.GAS, 'gas_high', critical_margin=100,
+         message='Gas level high: {v}{u} > {limit}ppm'),
+    Rule(Alert.BATTERY_LOW, SensorReading.BATTERY, 'batt_low', above=False, critical_margin=5,
+         message='Battery low: {v}{u} < {limit}%'),
+    Rule(Alert.PROXIMITY_NEAR, SensorReading.PROXIMITY, 'prox_near', above=False, inclusive=True,
+         message='Object near: {v}{u} <= {limit}cm'),
+    Rule(Alert.MOTION_DETECTED, SensorReading.MOTION, None, message='Motion detected'),
+)
+
+RULES_BY_SENSOR = {}
+for _rule in RULES:
+    RULES_BY_SENSOR.setdefault(_rule.sensor_type, []).append(_rule)
+
+
+def _generation_key(lunchbox_id):
+    return f'alertgen:{lunchbox_id}'
+
+
+def _state_key(lunchbox_id):
+    """Cache key of the current state; a new generation token on first use or after eviction."""
+    gen = cache.get(_generation_key(lunchbox_id))
+    if gen is None:
+        cache.add(_generation_key(lunchbox_id), uuid.uuid4().hex, None)
+        gen = cache.get(_generation_key(lunchbox_id))
+    return f'alertstate:{lunchbox_id}:{gen}'
+
+
+def invalidate_state(lunchbox_id):
+    """Drop the cached state in every process, once the current transaction commits."""
+    transaction.on_commit(lambda: cache.set(_generation_key(lunchbox_id), uuid.uuid4().hex, None))
+
+
+def _load_state(key, lunchbox):
+    state = cache.get(key)
+    if state is not None:
+        return state
+    state = {}
+    recent = (Alert.objects.filter(lunchbox_id=lunchbox.id, is_resolved=False,
+                                   created_at__gte=timezone.now() - RECENT_ALERT_WINDOW)
+              .order_by('created_at').values_list('alert_type', 'severity', 'created_at'))
+    for alert_type, severity, created_at in recent:
+        state[alert_type] = {'s': ACTIVE, 'sev': severity, 'hit': created_at.timestamp()}
+    return state
+
+
+def evaluate(lunchbox, readings, config=None):
+    """Run RULES over ``readings`` (oldest first) and write the resulting transitions.
+
+    Returns the alerts raised or escalated, for broadcasting.
+    """
+    config = config or effective_config(lunchbox)
+    limits, tuning = config['alerts'], config['rules']
+    key = _state_key(lunchbox.id)
+    state = _load_state(key, lunchbox)
+    raised, escalated, cleared = {}, {}, set()
+    closed = []  # raised and cleared within this batch: stored already resolved
+
+    for r in sorted(readings, key=lambda r: r.recorded_at):
+        value, at = float(r.value), r.recorded_at.timestamp()
+        for rule in RULES_BY_SENSOR.get(r.sensor_type, ()):
+            limit = limits.get(rule.threshold) if rule.threshold else None
+            opts = tuning.get(rule.alert_type, {})
+            st = state.get(rule.alert_type)
+            breached = rule.breached(value, limit)
+            if st and st['s'] == ACTIVE:
+                held = rule.threshold is None and at - st['hit'] >= opts.get('hold_s', 0)
+                if breached and not held:
+                    st['hit'] = at
+                    sev = rule.severity_for(value, limit)
+                    if SEVERITY_RANK[sev] > SEVERITY_RANK[st['sev']]:
+                        st['sev'] = sev
+                        escalated[rule.alert_type] = (rule, r, limit)
+                    continue
+                if not (held or rule.cleared(value, limit, opts.get('clear', 0))):
+                    continue
+                del state[rule.alert_type]
+                escalated.pop(rule.alert_type, None)
+                if rule.alert_type in raised:
+                    closed.append((rule.alert_type, st['sev']) + raised.pop(rule.alert_type))
+                else:
+                    cleared.add(rule.alert_type)  # stored before this batch
+                st = None
+            if not breached:
+                if st:
+                    del state[rule.alert_type]  # debounce broken
+                continue
+            n = (st['n'] if st else 0) + 1
+            if n < opts.get('debounce', 1):
+                state[rule.alert_type] = {'s': PENDING, 'n': n}
+                continue
+            state[rule.alert_type] = {'s': ACTIVE, 'sev': rule.severity_for(value, limit), 'hit': at}
+            raised[rule.alert_type] = (rule, r, limit)
+
+    now = timezone.now()
+    if cleared:
+        Alert.objects.filter(lunchbox_id=lunchbox.id, alert_type__in=cleared, is_resolved=False).update(
+            is_resolved=True, resolved_at=now)
+    for alert_type, (rule, r, limit) in escalated.items():
+        if alert_type not in raised:
+            Alert.objects.filter(lunchbox_id=lunchbox.id, alert_type=alert_type, is_resolved=False).update(
+                severity=state[alert_type]['sev'])
+    alerts = []
+    if raised or closed:
+        new = [
+            Alert(lunchbox_id=lunchbox.id, alert_type=alert_type, severity=state[alert_type]['sev'],
+                  message=rule.message.format(v=r.value, u=r.unit, limit=limit))
+            for alert_type, (rule, r, limit) in raised.items()
+        ] + [
+            Alert(lunchbox_id=lunchbox.id, alert_type=alert_type, severity=sev, is_resolved=True,
+                  resolved_at=now, message=rule.message.format(v=r.value, u=r.unit, limit=limit))
+            for alert_type, sev, rule, r, limit in closed
+        ]
+        alerts = Alert.objects.bulk_create(new)
+    # Escalations are broadcast as the alert's new severity (the row itself was updated in place)
+    alerts += [
+        Alert(lunchbox_id=lunchbox.id, alert_type=alert_type, severity=state[alert_type]['sev'],
+              message=rule.message.format(v=r.value, u=r.unit, limit=limit), created_at=now)
+        for alert_type, (rule, r, limit) in escalated.items() if alert_type not in raised
+    ]
+    transaction.on_commit(lambda: cache.set(key, state, STATE_TTL))
+    return alerts
@@ -0,0 +1,115 @@
+"""Device API key -> lunchbox lookup cache for ingest authentication.
+
+Two tiers in front of the ``Lunchbox.device_api_key`` lookup:
+
+- a per-process LRU with a short TTL, so a device posting every few seconds costs no
+  query and no cache round trip;
+- the Django cache (Redis when configured), shared by the workers, with a longer TTL.
+
+Entries are dropped on every save/delete of a lunchbox (signals.py) and for the old key in
+``Lunchbox.regenerate_api_key()``. Other workers' LRUs only hear about it through their TTL,
+so a revoked key can keep working there for at most DEVICE_KEY_LOCAL_TTL seconds. That bound
+needs the Django cache to be shared (settings.CACHES on Redis); on the per-process
+LocMemCache the second tier is cut to the local TTL as well. Unknown keys are cached too, so
+a misconfigured device does not hit the database on every POST.
+"""
+import hashlib
+import threading
+import time
+from collections import OrderedDict, namedtuple
+
+from django.conf import settings
+from django.core.cache import caches
+from django.core.cache.backends.locmem import LocMemCache
+
+from .models import Lunchbox
+
+DeviceKey = namedtuple('DeviceKey', 'lunchbox_id owner_id is_active device_config')
+
+# Fields loaded for the lunchbox handed to ingest; the rest stay deferred
+FIELDS = ('id', 'owner_id', 'is_active', 'device_config')
+
+_UNKNOWN = ()  # cached value for a key that matches no lunchbox
+
+
+def _cfg(name, default):
+    return getattr(settings, name, default)
+
+
+class _LocalLRU:
+    def __init__(self):
+        self._items = OrderedDict()
+        self._lock = threading.Lock()
+
+    def get(self, key):
+        with self._lock:
+            item = self._items.get(key)
+            if item is None:
+                return None
+            value, expires = item
+            if expires < time.monotonic():
+                del self._items[key]
+                return None
+            self._items.move_to_end(key)
+            return value
+
+    def set(self, key, value, ttl):
+        with self._lock:
+            self._items[key] = (value, time.monotonic() + ttl)
+            self._items.move_to_end(key)
+            while len(self._items) > _cfg('DEVICE_KEY_LOCAL_SIZE', 4096):
+                self._items.popitem(last=False)
+
+    def delete(self, key):
+        with self._lock:
+            self._items.pop(key, None)
+
+    def clear(self):
+        with self._lock:
+            self._items.clear()
+
+
+_local = _LocalLRU()
+
+
+def _cache_key(api_key):
+    # Hashed so raw keys never sit in the shared cache
+    return 'devkey:' + hashlib.sha256(str(api_key).encode()).hexdigest()[:32]
+
+
+def _shared():
+    return caches[_cfg('DEVICE_KEY_CACHE_ALIAS', 'default')]
+
+
+def _shared_ttl():
+    ttl = _cfg('DEVICE_KEY_CACHE_TTL', 300)
+    if isinstance(_shared(), LocMemCache):  # not shared: only the local TTL bounds revocation
+        ttl = min(ttl, _cfg('DEVICE_KEY_LOCAL_TTL', 30))
+    return ttl
+
+
+def lookup(api_key):
+    """DeviceKey for ``api_key``, or None when no lunchbox has it."""
+    key = _cache_key(api_key)
+    value = _local.get(key)
+    if value is None:
+        value = _shared().get(key)
+        if value is None:
+            row = Lunchbox.objects.filter(device_api_key=api_key).values_list(*FIELDS).first()
+            value = tuple(row) if row else _UNKNOWN
+            _shared().set(key, value, _shared_ttl())
+        _local.set(key, value, _cfg('DEVICE_KEY_LOCAL_TTL', 30))
+    return DeviceKey(*value) if value else None
+
+
+def lunchbox_for(entry, api_key):
+    """Lunchbox instance built from a cache entry without a query (other fields deferred)."""
+    data = dict(zip(FIELDS, entry), device_api_key=api_key)
+    names = [f.attname for f in Lunchbox._meta.concrete_fields if f.attname in data]  # from_db wants model order
+    return Lunchbox.from_db('default', names, [data[n] for n in names])
+
+
+def invalidate(api_key):
+    key = _cache_key(api_key)
+    _local.delete(key)
+    _shared().delete(key)
@@ -6,7 +6,7 @@ from channels.db import database_sync_to_async
 from django.contrib.auth.models import AnonymousUser
 from django.db.models import Avg, Max, Min, Count, Q
 from django.utils import timezone
-from .models import Lunchbox, SensorReading, Alert
+from .models import Lunchbox, LatestReading, SensorReading, Alert
 import logging
 logger = logging.getLogger(__name__)
 
@@ -68,17 +68,15 @@ class LunchboxConsumer(AsyncWebsocketConsumer):
     
     @database_sync_to_async
     def get_latest_readings(self):
-        """Get the latest sensor readings for this lunchbox."""
-        latest_readings = {}
-        qs = SensorReading.objects.filter(lunchbox_id=self.lunchbox_id).order_by('sensor_type', '-recorded_at')
-        for r in qs:
-            if r.sensor_type not in latest_readings:
-                latest_readings[r.sensor_type] = {
-                    'value': r.value,
-                    'unit': r.unit,
-                    'recorded_at': r.recorded_at.isoformat()
-                }
-        return latest_readings
+        """Get the latest sensor readings for this lunchbox (one row per sensor type)."""
+        return {
+            r.sensor_type: {
+                'value': r.value,
+                'unit': r.unit,
+                'recorded_at': r.recorded_at.isoformat()
+            }
+            for r in LatestReading.objects.filter(lunchbox_id=self.lunchbox_id)
+        }
     
     async def send_current_state(self):
         """Send the current state of the lunchbox to the client."""
@@ -134,3 +132,15 @@ class LunchboxConsumer(AsyncWebsocketConsumer):
             'message': event['message'],
             'created_at': event['created_at']
         }))
+
+    async def sensor_batch(self, event):
+        """
+        Send everything one device POST produced in a single frame:
+        the last reading per sensor type and the alerts it raised or re-raised.
+        """
+        await self.send(text_data=json.dumps({
+            'type': 'sensor_batch',
+            'lunchbox_id': self.lunchbox_id,
+            'readings': event['readings'],
+            'alerts': event['alerts'],
+        }))
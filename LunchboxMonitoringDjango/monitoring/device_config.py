@@ -0,0 +1,101 @@
+"""Device configuration, served in the ingest reply.
+
+The single source for the numbers the firmware and the server used to keep apart: sampling
+periods, the per-channel send policy (see ``lunchbox_logic.h``), batching, and the alert
+thresholds the server alerts on and the device pre-filters with. A lunchbox's
+``device_config`` JSON overrides any subset of DEFAULT_DEVICE_CONFIG; unknown keys and
+non-numeric values are ignored. The ``rules`` section tunes the server's alert rules
+(alert_rules.py) and is never sent to the device.
+
+Devices send the ETag of the config they run in ``X-Config-ETag``; the reply carries the
+compact config only when it differs.
+"""
+import copy
+import hashlib
+import json
+
+DEVICE_CONFIG_VERSION = 1  # wire schema; the firmware ignores a config with another version
+
+# Firmware channel order (CHANNELS table in lunchbox_logic.h)
+CHANNELS = ('temp', 'humi', 'gas', 'prox', 'motion', 'batt')
+CHANNEL_FIELDS = ('door', 'deadband', 'heartbeat_ms', 'min_gap_ms')
+PERIOD_FIELDS = ('dht_ms', 'prox_ms', 'pir_ms')
+BATCH_FIELDS = ('min_records', 'flush_ms', 'max_records')
+ALERT_FIELDS = ('temp_high', 'temp_low', 'humi_high', 'humi_low', 'gas_high', 'prox_near', 'batt_low')
+
+DEFAULT_DEVICE_CONFIG = {
+    'periods': {'dht_ms': 2500, 'prox_ms': 100, 'pir_ms': 50},
+    'channels': {
+        # gas door/deadband are decades of ppm (the channel is compressed on log10)
+        'temp': {'door': 0.15, 'deadband': 1.0, 'heartbeat_ms': 60000, 'min_gap_ms': 0},
+        'humi': {'door': 1.0, 'deadband': 5.0, 'heartbeat_ms': 60000, 'min_gap_ms': 0},
+        'gas': {'door': 0.02, 'deadband': 0.15, 'heartbeat_ms': 60000, 'min_gap_ms': 0},
+        'prox': {'door': 0.0, 'deadband': 2.0, 'heartbeat_ms': 120000, 'min_gap_ms': 2000},
+        'motion': {'door': 0.0, 'deadband': 0.5, 'heartbeat_ms': 120000, 'min_gap_ms': 0},
+        'batt': {'door': 0.0, 'deadband': 5.0, 'heartbeat_ms': 600000, 'min_gap_ms': 60000},
+    },
+    'batch': {'min_records': 5, 'flush_ms': 2000, 'max_records': 32},
+    'alerts': {
+        'temp_high': 30.0,   # °C
+        'temp_low': 4.0,     # °C
+        'humi_high': 75.0,   # %
+        'humi_low': 20.0,    # %
+        'gas_high': 200.0,   # ppm
+        'prox_near': 10.0,   # cm
+        'batt_low': 20.0,    # %
+    },
+    'rules': {
+        # clear: hysteresis band in the sensor's unit; debounce: breaching readings to raise
+        'temp_high': {'clear': 1.0, 'debounce': 1},
+        'temp_low': {'clear': 1.0, 'debounce': 1},
+        'humi_high': {'clear': 5.0, 'debounce': 1},
+        'humi_low': {'clear': 5.0, 'debounce': 1},
+        'gas_high': {'clear': 20.0, 'debounce': 1},
+        'batt_low': {'clear': 5.0, 'debounce': 1},
+        'prox_near': {'clear': 5.0, 'debounce': 2},
+        'motion_detected': {'hold_s': 300},  # one alert per motion episode
+    },
+}
+
+# Sections the device receives; the ETag covers only these
+DEVICE_SECTIONS = ('periods', 'channels', 'batch', 'alerts')
+
+
+def _merge(base, override):
+    """Overlay numeric values from ``override`` on the keys ``base`` already has."""
+    if not isinstance(override, dict):
+        return base
+    for key, value in override.items():
+        if key not in base:
+            continue
+        if isinstance(base[key], dict):
+            _merge(base[key], value)
+        elif isinstance(value, (int, float)) and not isinstance(value, bool):
+            base[key] = type(base[key])(value)
+    return base
+
+
+def effective_config(lunchbox):
+    """DEFAULT_DEVICE_CONFIG with the lunchbox's overrides applied."""
+    return _merge(copy.deepcopy(DEFAULT_DEVICE_CONFIG), getattr(lunchbox, 'device_config', None) or {})
+
+
+def alert_thresholds(lunchbox):
+    return effective_config(lunchbox)['alerts']
+
+
+def config_etag(config):
+    blob = json.dumps({k: config[k] for k in DEVICE_SECTIONS}, sort_keys=True, separators=(',', ':')).encode()
+    return hashlib.sha1(blob).hexdigest()[:12]
+
+
+def compact_config(config):
+    """Positional wire form the firmware parses (field order as in the *_FIELDS tuples)."""
+    return {
+        'v': DEVICE_CONFIG_VERSION,
+        'e': config_etag(config),
+        'p': [config['periods'][f] for f in PERIOD_FIELDS],
+        'c': [[config['channels'][ch][f] for f in CHANNEL_FIELDS] for ch in CHANNELS],
+        'b': [config['batch'][f] for f in BATCH_FIELDS],
+        'a': [config['alerts'][f] for f in ALERT_FIELDS],
+    }
@@ -0,0 +1,80 @@
+"""Streaming export of a lunchbox's raw readings (CSV or NDJSON).
+
+Readings are read in keyset order -- per sensor type, by (recorded_at, id) -- one index range
+of CHUNK_SIZE rows per query, as plain ``values_list`` tuples. Memory stays at one chunk
+however long the history is, and the first rows go out as soon as the first chunk is read.
+(A single ``.iterator()`` query would not do on its own: the MySQL driver buffers the whole
+result set client-side.)
+"""
+import csv
+import io
+import json
+
+from django.db.models import Q
+
+from .models import SensorReading
+
+CHUNK_SIZE = 2000
+COLUMNS = ('sensor_type', 'recorded_at', 'value', 'unit')
+
+
+def iter_readings(lunchbox_id, sensor_types, start=None, end=None, chunk_size=CHUNK_SIZE):
+    """(sensor_type, recorded_at, value, unit) tuples, each sensor type oldest first."""
+    for sensor_type in sensor_types:
+        base = SensorReading.objects.filter(lunchbox_id=lunchbox_id, sensor_type=sensor_type)
+        if start:
+            base = base.filter(recorded_at__gte=start)
+        if end:
+            base = base.filter(recorded_at__lt=end)
+        after = None
+        while True:
+            qs = base
+            if after:
+                qs = qs.filter(Q(recorded_at__gt=after[0]) | Q(recorded_at=after[0], id__gt=after[1]))
+            rows = qs.order_by('recorded_at', 'id').values_list('id', 'recorded_at', 'value', 'unit')[:chunk_size]
+            n = 0
+            for pk, recorded_at, value, unit in rows.iterator(chunk_size=chunk_size):
+                n += 1
+                after = (recorded_at, pk)
+                yield sensor_type, recorded_at, value, unit
+            if n < chunk_size:
+                break
+
+
+def _batched(lines, size):
+    """Join lines so the response writes a few KB at a time rather than one row."""
+    buf = []
+    for line in lines:
+        buf.append(line)
+        if len(buf) >= size:
+            yield ''.join(buf)
+            buf = []
+    if buf:
+        yield ''.join(buf)
+
+
+def csv_stream(rows, chunk_size=CHUNK_SIZE):
+    out = io.StringIO()
+    writer = csv.writer(out)
+
+    def line(values):
+        writer.writerow(values)
+        text = out.getvalue()
+        out.seek(0)
+        out.truncate()
+        return text
+
+    def lines():
+        yield line(COLUMNS)
+        for sensor_type, recorded_at, value, unit in rows:
+            yield line((sensor_type, recorded_at.isoformat(), value, unit))
+
+    return _batched(lines(), chunk_size)
+
+
+def ndjson_stream(rows, chunk_size=CHUNK_SIZE):
+    lines = (
+        json.dumps({'sensor_type': s, 'recorded_at': t.isoformat(), 'value': v, 'unit': u}) + '\n'
+        for s, t, v, u in rows
+    )
+    return _batched(lines, chunk_size)
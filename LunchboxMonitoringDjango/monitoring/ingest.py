@@ -0,0 +1,161 @@
+"""Bulk device ingest.
+
+One POST is one transaction with a fixed number of queries, however many readings it
+carries: the readings are inserted with a single ``bulk_create`` and the whole batch is
+run through the alert rules (alert_rules.py), which query only to record a transition.
+
+The same rules back the ``post_save`` receiver in signals.py for readings saved one at a
+time, so both paths alert alike. Inside ``bulk_ingest()`` that receiver stands down. Both
+paths also keep LatestReading current.
+
+``broadcast_batch()`` then pushes the outcome of the POST to the lunchbox's WebSocket group
+as a single ``sensor_batch`` event.
+
+With DEVICE_INGEST_ASYNC the view stops after validation: the batch goes to the Celery
+``monitoring`` queue as ``encode_batch()`` rows and the ``ingest_batch`` task (tasks.py) does
+the rest.
+"""
+import logging
+import threading
+from contextlib import contextmanager
+from datetime import datetime
+
+from django.db import connection, transaction
+
+from . import alert_rules
+from .models import LatestReading, SensorReading
+from .series import is_sample
+
+logger = logging.getLogger(__name__)
+
+_state = threading.local()
+
+
+@contextmanager
+def bulk_ingest():
+    """Mark the current thread as inside a bulk ingest (per-row alert signals are skipped)."""
+    previous = getattr(_state, 'active', False)
+    _state.active = True
+    try:
+        yield
+    finally:
+        _state.active = previous
+
+
+def in_bulk_ingest():
+    return getattr(_state, 'active', False)
+
+
+class QueryCounter:
+    """``connection.execute_wrapper`` callable counting the queries run under it."""
+
+    def __init__(self):
+        self.count = 0
+
+    def __call__(self, execute, sql, params, many, context):
+        self.count += 1
+        return execute(sql, params, many, context)
+
+
+def upsert(model, rows, unique_fields, update_fields):
+    """bulk_create that overwrites ``update_fields`` of rows already present (one query)."""
+    # MySQL upserts on any unique key and rejects an explicit conflict target
+    target = unique_fields if connection.features.supports_update_conflicts_with_target else None
+    model.objects.bulk_create(rows, update_conflicts=True, unique_fields=target, update_fields=update_fields)
+
+
+def newest_samples(readings):
+    """{sensor_type: reading} with the latest ``recorded_at`` per type (the later one on a tie).
+
+    Non-sample rows (motion edge counts) are not a current value and are skipped.
+    """
+    newest = {}
+    for r in readings:
+        if not is_sample(r.sensor_type, r.unit):
+            continue
+        cur = newest.get(r.sensor_type)
+        if cur is None or r.recorded_at >= cur.recorded_at:
+            newest[r.sensor_type] = r
+    return newest
+
+
+def update_latest(lunchbox, readings):
+    """Move the LatestReading rows of ``lunchbox`` forward to ``readings`` (two queries at most).
+
+    Rows only move forward in time, so late (spooled) readings leave newer ones in place.
+    """
+    newest = newest_samples(readings)
+    if not newest:
+        return
+    stored = dict(LatestReading.objects.filter(lunchbox=lunchbox, sensor_type__in=list(newest))
+                  .values_list('sensor_type', 'recorded_at'))
+    rows = [
+        LatestReading(lunchbox_id=lunchbox.id, sensor_type=t, value=r.value, unit=r.unit,
+                      recorded_at=r.recorded_at)
+        for t, r in newest.items()
+        if t not in stored or r.recorded_at >= stored[t]
+    ]
+    if rows:
+        upsert(LatestReading, rows, ['lunchbox', 'sensor_type'], ['value', 'unit', 'recorded_at'])
+
+
+def ingest_readings(lunchbox, parsed_readings, config=None):
+    """Insert validated readings and evaluate alerts in one transaction.
+
+    ``config`` is the lunchbox's effective config when the caller already has it.
+    Returns ``(created_readings, alerts)``. A failure in alert evaluation is logged and
+    rolled back on its own; the readings are still stored.
+    """
+    with transaction.atomic(), bulk_ingest():
+        created = SensorReading.objects.bulk_create([SensorReading(**rd) for rd in parsed_readings])
+        update_latest(lunchbox, created)
+        alerts = []
+        try:
+            with transaction.atomic():
+                alerts = alert_rules.evaluate(lunchbox, created, config)
+        except Exception:
+            logger.exception("Alert evaluation failed lunchbox=%s", lunchbox.id)
+    return created, alerts
+
+
+def encode_batch(parsed_readings):
+    """Validated readings as JSON rows [sensor_type, value, unit, recorded_at] for a task."""
+    return [[rd['sensor_type'], rd['value'], rd['unit'], rd['recorded_at'].isoformat()]
+            for rd in parsed_readings]
+
+
+def decode_batch(lunchbox, rows):
+    return [{'lunchbox': lunchbox, 'sensor_type': t, 'value': v, 'unit': u,
+             'recorded_at': datetime.fromisoformat(at)} for t, v, u, at in rows]
+
+
+def batch_event(created, alerts):
+    """``sensor_batch`` channel event: the newest sample per sensor type and the alerts of a POST."""
+    latest = newest_samples(created)
+    return {
+        'type': 'sensor_batch',
+        'readings': [
+            {'sensor_type': r.sensor_type, 'value': r.value, 'unit': r.unit,
+             'recorded_at': r.recorded_at.isoformat()}
+            for r in latest.values()
+        ],
+        'alerts': [
+            {'alert_type': a.alert_type, 'severity': a.severity, 'message': a.message,
+             'created_at': a.created_at.isoformat()}
+            for a in alerts
+        ],
+    }
+
+
+def broadcast_batch(lunchbox, created, alerts):
+    """One group_send per POST (non-fatal if the channel layer is unavailable)."""
+    if not created and not alerts:
+        return
+    try:
+        from channels.layers import get_channel_layer
+        from asgiref.sync import async_to_sync
+        channel_layer = get_channel_layer()
+        if channel_layer:  # In-memory or redis layer
+            async_to_sync(channel_layer.group_send)(f'lunchbox_{lunchbox.id}', batch_event(created, alerts))
+    except Exception as e:  # Log and continue (avoid ingestion failure due to Redis)
+        logger.warning("Channel broadcast skipped: %s", e)
@@ -0,0 +1,309 @@
+"""Ingest load test: a simulated device fleet (``manage.py loadtest_ingest``).
+
+Each simulated device posts what the firmware's buildBatchJson() posts: one snapshot of
+temp/humi/gas/prox/motion/batt per flush, motion as an int, the gas meta fields (raw, min,
+max, cal_src) on the first gas reading after boot, ``recorded_at`` to the second in UTC, and
+X-Config-ETag once the server has handed out a config. Devices honour Retry-After on 429/503
+and the ``pace`` hint, as the firmware does, so shedding shows up as status counts and longer
+intervals rather than as a retry storm.
+
+Transports:
+- in-process (default): django.test.Client in the calling thread, so one process measures
+  the view, ORM and channel layer without an HTTP server in front;
+- ``--url``: HTTP POSTs to a running node, for sizing it behind its real server.
+
+Queries per POST come from the view's X-Ingest-Queries header in both cases. Subscribers are
+LunchboxConsumer instances driven by channels.testing.WebsocketCommunicator on their own
+event loop (authenticated by putting the owner in the scope). Each device POSTs one at a time
+and the view sends one frame per POST to the lunchbox group, so the k-th ``sensor_batch``
+frame a subscriber receives pairs with the device's k-th accepted POST; fan-out latency is
+the time from that POST's start to the frame. Against ``--url`` this only works when the
+channel layer is shared (Redis).
+"""
+import asyncio
+import json
+import random
+import threading
+import time
+import urllib.error
+import urllib.request
+from collections import Counter, deque
+from datetime import datetime, timezone as dt_timezone
+
+from django.conf import settings
+
+INGEST_PATH = '/api/ingest/device/'
+RETRY_AFTER_MAX_S = 60  # the firmware's RETRY_AFTER_MAX_MS
+
+
+def percentile(values, p):
+    """Nearest-rank percentile (p in 0..100) of a list; None when empty."""
+    if not values:
+        return None
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, max(0, round(p / 100 * len(ordered)) - 1))]
+
+
+class DeviceState:
+    """Slowly wandering sensor values for one simulated box."""
+
+    def __init__(self, rnd):
+        self.rnd = rnd
+        self.temp = rnd.uniform(4, 8)
+        self.humi = rnd.uniform(40, 60)
+        self.ppm = rnd.uniform(20, 60)
+        self.prox = rnd.uniform(20, 40)
+        self.motion = 0
+        self.batt = rnd.uniform(60, 100)
+        self.gas_meta_sent = False
+
+    def step(self):
+        r = self.rnd
+        self.temp += r.gauss(0, 0.1)
+        self.humi = min(100.0, max(0.0, self.humi + r.gauss(0, 0.5)))
+        self.ppm = max(0.1, self.ppm * (1 + r.gauss(0, 0.02)))
+        self.prox = max(2.0, self.prox + r.gauss(0, 0.5))
+        if r.random() < 0.05:
+            self.motion ^= 1
+        self.batt = max(0.0, self.batt - 0.001)
+
+    def readings(self, now):
+        stamp = datetime.fromtimestamp(int(now), dt_timezone.utc).strftime('%Y-%m-%dT%H:%M:%SZ')
+        gas = {'sensor_type': 'gas', 'value': round(self.ppm, 2), 'unit': 'ppm'}
+        if not self.gas_meta_sent:
+            gas.update(raw=1840, min=1790, max=1905, cal_src='stored')
+            self.gas_meta_sent = True
+        rows = [
+            {'sensor_type': 'temp', 'value': round(self.temp, 2), 'unit': 'C'},
+            {'sensor_type': 'humi', 'value': round(self.humi, 2), 'unit': '%'},
+            gas,
+            {'sensor_type': 'prox', 'value': round(self.prox, 1), 'unit': 'cm'},
+            {'sensor_type': 'motion', 'value': self.motion, 'unit': ''},
+            {'sensor_type': 'batt', 'value': round(self.batt, 1), 'unit': '%'},
+        ]
+        for row in rows:
+            row['recorded_at'] = stamp
+        return rows
+
+
+def device_payload(api_key, state, now, snapshots=1):
+    """JSON body of one flush: ``snapshots`` consecutive samples, one second apart."""
+    readings = []
+    for i in range(snapshots):
+        state.step()
+        readings += state.readings(now - (snapshots - 1 - i))
+    return {'api_key': api_key, 'readings': readings}
+
+
+# --- transports: post(body, headers) -> (status, reply headers, reply body) -----------------
+
+class InProcessTransport:
+    def __init__(self):
+        from django.test import Client
+        # The test client sends Host: testserver, which ALLOWED_HOSTS rejects outside tests
+        host = next((h.lstrip('.') for h in settings.ALLOWED_HOSTS if h not in ('*', '')), 'localhost')
+        self.client = Client(HTTP_HOST=host)
+
+    def post(self, body, headers):
+        extra = {'HTTP_' + k.upper().replace('-', '_'): v for k, v in headers.items()}
+        response = self.client.post(INGEST_PATH, json.dumps(body), content_type='application/json', **extra)
+        try:
+            data = json.loads(response.content or b'{}')
+        except ValueError:
+            data = {}
+        return response.status_code, response, data
+
+
+class HttpTransport:
+    def __init__(self, base_url, timeout=30):
+        self.url = base_url.rstrip('/') + INGEST_PATH
+        self.timeout = timeout
+
+    def post(self, body, headers):
+        request = urllib.request.Request(self.url, data=json.dumps(body).encode(), method='POST',
+                                         headers={'Content-Type': 'application/json', **headers})
+        try:
+            with urllib.request.urlopen(request, timeout=self.timeout) as response:
+                return response.status, response.headers, json.loads(response.read() or b'{}')
+        except urllib.error.HTTPError as e:
+            try:
+                data = json.loads(e.read() or b'{}')
+            except ValueError:
+                data = {}
+            return e.code, e.headers, data
+
+
+class Stats:
+    """Shared by the device threads and the subscriber loop."""
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.status = Counter()
+        self.latency = []  # seconds, accepted POSTs
+        self.queries = []
+        self.readings = 0
+        self.errors = 0
+        self.fanout = []   # seconds, POST start -> sensor_batch frame
+        self.frames = 0
+        self.unmatched = 0
+        self.sent = {}     # lunchbox id -> one deque per subscriber of POST start times awaiting a frame
+
+    def post_done(self, status, elapsed, queries, n):
+        with self.lock:
+            self.status[status] += 1
+            if status in (201, 202):
+                self.latency.append(elapsed)
+                self.readings += n
+            if queries is not None:
+                self.queries.append(queries)
+
+
+class SimDevice:
+    """One firmware instance: flush every ``interval_s``, back off as the server asks."""
+
+    def __init__(self, lunchbox_id, api_key, interval_s, stats, snapshots=1, seed=None):
+        self.lunchbox_id = lunchbox_id
+        self.api_key = api_key
+        self.interval_s = interval_s
+        self.snapshots = snapshots
+        self.stats = stats
+        self.rnd = random.Random(seed)
+        self.state = DeviceState(self.rnd)
+        self.etag = None
+        self.pending = None  # body held on the device across a shed or rejected POST
+
+    def step(self, transport):
+        """One POST; returns the seconds to wait before the next."""
+        body = self.pending or device_payload(self.api_key, self.state, time.time(), self.snapshots)
+        headers = {'X-Config-ETag': self.etag} if self.etag else {}
+        # Queued before the POST: the frame can reach a subscriber before the reply reaches us
+        subscribers = self.stats.sent.get(self.lunchbox_id, ())
+        started = time.monotonic()
+        with self.stats.lock:
+            for queue in subscribers:
+                queue.append(started)
+        try:
+            status, reply_headers, data = transport.post(body, headers)
+        except Exception:
+            status, reply_headers, data = None, {}, {}
+        elapsed = time.monotonic() - started
+        if status not in (201, 202):
+            with self.stats.lock:  # no frame will come for this one
+                for queue in subscribers:
+                    if queue and queue[-1] == started:
+                        queue.pop()
+        if status is None:
+            with self.stats.lock:
+                self.stats.errors += 1
+            self.pending = body
+            return self.interval_s
+        queries = reply_headers.get('X-Ingest-Queries')
+        self.stats.post_done(status, elapsed, int(queries) if queries else None, len(body['readings']))
+        if status in (201, 202):
+            self.pending = None
+            self.etag = reply_headers.get('ETag') or self.etag
+            pace = data.get('pace') if isinstance(data, dict) else None
+            if pace:  # [min_records, flush_ms]: the firmware batches up to flush_ms before the next POST
+                return max(self.interval_s, pace[1] / 1000)
+            return self.interval_s
+        self.pending = body
+        if status in (429, 503):
+            try:
+                hint = float(reply_headers.get('Retry-After') or 0)
+            except ValueError:
+                hint = 0
+            return min(RETRY_AFTER_MAX_S, max(hint, self.interval_s)) * self.rnd.uniform(1.0, 1.25)
+        return self.interval_s
+
+    def run(self, transport_factory, deadline):
+        from django.db import connection
+        transport = transport_factory()
+        time.sleep(self.rnd.uniform(0, self.interval_s))  # devices boot at different times
+        try:
+            while time.monotonic() < deadline:
+                wait = self.step(transport)
+                time.sleep(max(0.0, min(wait, deadline - time.monotonic())))
+        finally:
+            connection.close()
+
+
+# --- subscribers ---------------------------------------------------------------------------
+
+async def _subscribe(user, lunchbox_id, queue, stats, stop):
+    from channels.routing import URLRouter
+    from channels.testing import WebsocketCommunicator
+    from .routing import websocket_urlpatterns
+
+    communicator = WebsocketCommunicator(URLRouter(websocket_urlpatterns), f'/ws/monitoring/{lunchbox_id}/')
+    communicator.scope['user'] = user
+    connected, _ = await communicator.connect()
+    if not connected:
+        with stats.lock:
+            stats.errors += 1
+        return
+    try:
+        while not stop.is_set():
+            try:
+                frame = json.loads(await communicator.receive_from(timeout=0.5))
+            except asyncio.TimeoutError:
+                continue
+            if frame.get('type') != 'sensor_batch':
+                continue
+            now = time.monotonic()
+            with stats.lock:
+                stats.frames += 1
+                if queue:
+                    stats.fanout.append(now - queue.popleft())
+                else:
+                    stats.unmatched += 1
+    finally:
+        await communicator.disconnect()
+
+
+def start_subscribers(user, lunchbox_ids, count, stats):
+    """``count`` LunchboxConsumer subscribers, round-robin over the lunchboxes.
+
+    Returns a stop() callable that disconnects them and waits for the loop to finish.
+    """
+    stop = threading.Event()
+    jobs = []
+    for i in range(count):
+        lunchbox_id = lunchbox_ids[i % len(lunchbox_ids)]
+        queue = deque()
+        stats.sent.setdefault(lunchbox_id, []).append(queue)
+        jobs.append((lunchbox_id, queue))
+
+    ready = threading.Event()
+
+    def loop():
+        async def main():
+            tasks = [asyncio.ensure_future(_subscribe(user, lb, q, stats, stop)) for lb, q in jobs]
+            await asyncio.sleep(1.0)  # let the consumers join their groups before devices post
+            ready.set()
+            await asyncio.gather(*tasks, return_exceptions=True)
+        asyncio.run(main())
+        ready.set()
+
+    thread = threading.Thread(target=loop, name='loadtest-subscribers', daemon=True)
+    thread.start()
+    ready.wait(timeout=30)
+
+    def stop_all():
+        stop.set()
+        thread.join(timeout=30)
+    return stop_all
+
+
+def run_fleet(lunchboxes, duration_s, interval_s, transport_factory, stats, snapshots=1):
+    """Run one SimDevice thread per lunchbox for ``duration_s``; returns the wall time taken."""
+    deadline = time.monotonic() + duration_s
+    devices = [SimDevice(lb.id, lb.device_api_key, interval_s, stats, snapshots, seed=lb.id)
+               for lb in lunchboxes]
+    threads = [threading.Thread(target=d.run, args=(transport_factory, deadline), daemon=True)
+               for d in devices]
+    started = time.monotonic()
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    return time.monotonic() - started
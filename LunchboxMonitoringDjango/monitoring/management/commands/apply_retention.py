@@ -0,0 +1,18 @@
+from django.core.management.base import BaseCommand
+
+from monitoring import retention
+
+
+class Command(BaseCommand):
+    help = "Expire readings older than READINGS_RETENTION_DAYS (same job as the nightly cleanup-old-data task)."
+
+    def handle(self, *args, **options):
+        summary = retention.apply_retention()
+        if 'dropped_partitions' in summary:
+            self.stdout.write(f"Dropped partitions: {', '.join(summary['dropped_partitions']) or 'none'}")
+            self.stdout.write(f"Added partitions: {', '.join(summary['added_partitions']) or 'none'}")
+        else:
+            self.stdout.write(f"Deleted {summary['deleted_readings']} sensor readings (chunked purge).")
+        self.stdout.write(self.style.SUCCESS(
+            f"Deleted {summary['deleted_minute_rollups']} minute rollups; cutoff {summary['cutoff']}"
+        ))
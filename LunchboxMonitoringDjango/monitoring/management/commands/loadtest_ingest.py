@@ -0,0 +1,101 @@
+from django.conf import settings
+from django.contrib.auth import get_user_model
+from django.core.management.base import BaseCommand, CommandError
+
+from monitoring import loadtest
+from monitoring.models import Lunchbox
+
+LOADTEST_EMAIL = 'loadtest@lunchbox.invalid'
+LOADTEST_PREFIX = 'loadtest-'
+
+
+class Command(BaseCommand):
+    help = ("Drive device ingest with a simulated fleet and WebSocket subscribers (monitoring/loadtest.py); "
+            "reports throughput, ingest latency, queries per POST and broadcast fan-out latency.")
+
+    def add_arguments(self, parser):
+        parser.add_argument('--devices', type=int, default=20, help='Simulated devices, one lunchbox each')
+        parser.add_argument('--duration', type=float, default=60, help='Seconds to run')
+        parser.add_argument('--interval', type=float, default=5,
+                            help='Seconds between a device\'s POSTs (the device_ingest throttle applies per device)')
+        parser.add_argument('--snapshots', type=int, default=1, help='Sensor snapshots per POST (6 readings each)')
+        parser.add_argument('--subscribers', type=int, default=None,
+                            help='LunchboxConsumer subscribers, spread over the lunchboxes (default: one per device)')
+        parser.add_argument('--url', default='',
+                            help='Base URL of a running node; default posts in-process through the Django test client')
+        parser.add_argument('--cleanup', action='store_true',
+                            help='Delete the load-test lunchboxes, their readings and alerts afterwards')
+
+    def handle(self, *args, **options):
+        devices = options['devices']
+        if devices < 1 or options['interval'] <= 0 or options['snapshots'] < 1:
+            raise CommandError("--devices, --interval and --snapshots must be positive")
+        subscribers = devices if options['subscribers'] is None else options['subscribers']
+        url = options['url']
+        layer = settings.CHANNEL_LAYERS.get('default', {}).get('BACKEND', '')
+        if url and subscribers and 'InMemory' in layer:
+            self.stdout.write(self.style.WARNING(
+                "In-memory channel layer is per process: no fan-out measurement against --url"))
+            subscribers = 0
+
+        user, lunchboxes = self._fleet(devices)
+        if url:
+            transport_factory = lambda: loadtest.HttpTransport(url)  # noqa: E731
+        else:
+            transport_factory = loadtest.InProcessTransport
+
+        stats = loadtest.Stats()
+        stop_subscribers = None
+        if subscribers:
+            stop_subscribers = loadtest.start_subscribers(user, [lb.id for lb in lunchboxes], subscribers, stats)
+        self.stdout.write(f"{devices} devices every {options['interval']}s for {options['duration']}s, "
+                          f"{subscribers} subscribers, {'HTTP ' + url if url else 'in-process'}")
+        try:
+            wall = loadtest.run_fleet(lunchboxes, options['duration'], options['interval'],
+                                      transport_factory, stats, options['snapshots'])
+        finally:
+            if stop_subscribers:
+                stop_subscribers()
+        self._report(stats, wall)
+
+        if options['cleanup']:
+            deleted, _ = Lunchbox.objects.filter(owner=user, name__startswith=LOADTEST_PREFIX).delete()
+            self.stdout.write(f"Deleted {deleted} load-test rows")
+
+    def _fleet(self, devices):
+        """The load-test owner and ``devices`` lunchboxes (created on first use, reused after)."""
+        User = get_user_model()
+        user = User.objects.filter(email=LOADTEST_EMAIL).first()
+        if user is None:
+            user = User.objects.create_user(email=LOADTEST_EMAIL, password=None)
+        existing = {lb.name: lb for lb in Lunchbox.objects.filter(owner=user, name__startswith=LOADTEST_PREFIX)}
+        lunchboxes = []
+        for i in range(devices):
+            name = f'{LOADTEST_PREFIX}{i:04d}'
+            lb = existing.get(name) or Lunchbox.objects.create(name=name, owner=user)
+            if not lb.is_active:
+                lb.is_active = True
+                lb.save(update_fields=['is_active'])
+            lunchboxes.append(lb)
+        return user, lunchboxes
+
+    def _report(self, stats, wall):
+        def ms(v):
+            return '-' if v is None else f'{v * 1000:.1f}ms'
+
+        posts = sum(stats.status.values())
+        accepted = stats.status[201] + stats.status[202]
+        self.stdout.write(f"POSTs       {posts} in {wall:.1f}s: {accepted / wall:.1f}/s accepted, "
+                          f"{stats.readings / wall:.0f} readings/s")
+        self.stdout.write("status      " + (', '.join(f'{code}: {n}' for code, n in sorted(stats.status.items()))
+                                             or '-') + (f", transport errors: {stats.errors}" if stats.errors else ''))
+        self.stdout.write(f"latency     p50 {ms(loadtest.percentile(stats.latency, 50))}  "
+                          f"p99 {ms(loadtest.percentile(stats.latency, 99))}  "
+                          f"max {ms(max(stats.latency) if stats.latency else None)}")
+        if stats.queries:
+            self.stdout.write(f"queries     {sum(stats.queries) / len(stats.queries):.1f}/POST "
+                              f"(max {max(stats.queries)})")
+        if stats.sent:
+            self.stdout.write(f"fan-out     {stats.frames} frames: p50 {ms(loadtest.percentile(stats.fanout, 50))}  "
+                              f"p99 {ms(loadtest.percentile(stats.fanout, 99))}"
+                              + (f", {stats.unmatched} unmatched" if stats.unmatched else ''))
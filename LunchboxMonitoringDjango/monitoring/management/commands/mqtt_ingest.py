@@ -0,0 +1,22 @@
+from django.core.management.base import BaseCommand, CommandError
+
+from monitoring import mqtt
+
+
+class Command(BaseCommand):
+    help = "Ingest device readings published over MQTT (monitoring/mqtt.py); runs until interrupted."
+
+    def add_arguments(self, parser):
+        parser.add_argument('--client-id', default='lunchbox-ingest',
+                            help="MQTT client id; keep it stable so the broker keeps the session")
+
+    def handle(self, *args, **options):
+        try:
+            import paho.mqtt.client  # noqa: F401
+        except ImportError:
+            raise CommandError("paho-mqtt is not installed (pip install 'paho-mqtt<2')")
+        self.stdout.write(f"Subscribing to {mqtt.topic_prefix()}/+/up")
+        try:
+            mqtt.run(client_id=options['client_id'])
+        except KeyboardInterrupt:
+            self.stdout.write(self.style.SUCCESS("Stopped"))
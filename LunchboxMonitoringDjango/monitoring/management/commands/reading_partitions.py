@@ -0,0 +1,34 @@
+from django.core.management.base import BaseCommand, CommandError
+
+from monitoring import retention
+
+
+class Command(BaseCommand):
+    help = "Manage monthly MySQL partitions of the sensor readings table (see monitoring/retention.py)."
+
+    def add_arguments(self, parser):
+        parser.add_argument('action', choices=['status', 'setup', 'ensure'],
+                            help="status: list partitions; setup: convert the table (rewrites it once); "
+                                 "ensure: add partitions for the coming months.")
+        parser.add_argument('--months-ahead', type=int, default=2, help='Future months to pre-create.')
+
+    def handle(self, *args, **opts):
+        action = opts['action']
+        if action == 'setup':
+            try:
+                created = retention.setup_partitions(opts['months_ahead'])
+            except RuntimeError as e:
+                raise CommandError(str(e))
+            if not created:
+                self.stdout.write("Readings table is already partitioned.")
+            else:
+                self.stdout.write(self.style.SUCCESS(f"Partitioned readings into {len(created)} months: {', '.join(created)}"))
+        elif action == 'ensure':
+            added = retention.ensure_partitions(opts['months_ahead'])
+            self.stdout.write(self.style.SUCCESS(f"Added partitions: {', '.join(added) or 'none'}"))
+        else:
+            parts = retention.partitions()
+            if not parts:
+                self.stdout.write("Readings table is not partitioned; retention uses the chunked purge.")
+            for name, bound in parts:
+                self.stdout.write(f"{name}\t{'MAXVALUE' if bound is None else bound}")
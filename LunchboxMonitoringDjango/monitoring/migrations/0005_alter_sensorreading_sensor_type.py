@@ -0,0 +1,18 @@
+# Generated by Django 4.2.14 on 2026-10-14 09:00
+
+from django.db import migrations, models
+
+
+class Migration(migrations.Migration):
+
+    dependencies = [
+        ('monitoring', '0004_alter_lunchbox_owner'),
+    ]
+
+    operations = [
+        migrations.AlterField(
+            model_name='sensorreading',
+            name='sensor_type',
+            field=models.CharField(choices=[('temp', 'Temperature'), ('humi', 'Humidity'), ('gas', 'Gas Level'), ('batt', 'Battery Level'), ('prox', 'Proximity/Distance'), ('motion', 'Motion/PIR'), ('diag', 'Device Diagnostics')], help_text='Type of sensor reading', max_length=12),
+        ),
+    ]
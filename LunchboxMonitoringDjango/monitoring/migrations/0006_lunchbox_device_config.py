@@ -0,0 +1,18 @@
+# Generated by Django 4.2.14 on 2026-10-14 09:00
+
+from django.db import migrations, models
+
+
+class Migration(migrations.Migration):
+
+    dependencies = [
+        ('monitoring', '0005_alter_sensorreading_sensor_type'),
+    ]
+
+    operations = [
+        migrations.AddField(
+            model_name='lunchbox',
+            name='device_config',
+            field=models.JSONField(blank=True, default=dict, help_text='Overrides of the default device config (see monitoring/device_config.py)'),
+        ),
+    ]
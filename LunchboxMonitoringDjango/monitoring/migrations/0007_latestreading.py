@@ -0,0 +1,46 @@
+# Generated by Django 4.2.14 on 2026-10-14 12:00
+
+from django.db import migrations, models
+from django.db.models import Max
+import django.db.models.deletion
+
+
+def backfill_latest(apps, schema_editor):
+    SensorReading = apps.get_model('monitoring', 'SensorReading')
+    LatestReading = apps.get_model('monitoring', 'LatestReading')
+    pairs = (SensorReading.objects.values('lunchbox_id', 'sensor_type')
+             .annotate(latest=Max('recorded_at')).order_by())
+    rows = []
+    for p in pairs:
+        r = (SensorReading.objects
+             .filter(lunchbox_id=p['lunchbox_id'], sensor_type=p['sensor_type'], recorded_at=p['latest'])
+             .order_by('-id').first())
+        rows.append(LatestReading(lunchbox_id=r.lunchbox_id, sensor_type=r.sensor_type,
+                                  value=r.value, unit=r.unit, recorded_at=r.recorded_at))
+    LatestReading.objects.bulk_create(rows, batch_size=500)
+
+
+class Migration(migrations.Migration):
+
+    dependencies = [
+        ('monitoring', '0006_lunchbox_device_config'),
+    ]
+
+    operations = [
+        migrations.CreateModel(
+            name='LatestReading',
+            fields=[
+                ('id', models.BigAutoField(auto_created=True, primary_key=True, serialize=False, verbose_name='ID')),
+                ('sensor_type', models.CharField(choices=[('temp', 'Temperature'), ('humi', 'Humidity'), ('gas', 'Gas Level'), ('batt', 'Battery Level'), ('prox', 'Proximity/Distance'), ('motion', 'Motion/PIR'), ('diag', 'Device Diagnostics')], max_length=12)),
+                ('value', models.FloatField()),
+                ('unit', models.CharField(max_length=10)),
+                ('recorded_at', models.DateTimeField()),
+                ('lunchbox', models.ForeignKey(help_text='The lunchbox this reading belongs to', on_delete=django.db.models.deletion.CASCADE, related_name='latest_readings', to='monitoring.lunchbox')),
+            ],
+        ),
+        migrations.AddConstraint(
+            model_name='latestreading',
+            constraint=models.UniqueConstraint(fields=('lunchbox', 'sensor_type'), name='unique_latest_reading'),
+        ),
+        migrations.RunPython(backfill_latest, migrations.RunPython.noop),
+    ]
@@ -0,0 +1,40 @@
+# Generated by Django 4.2.14 on 2026-10-14 13:00
+
+from django.db import migrations, models
+import django.db.models.deletion
+
+
+class Migration(migrations.Migration):
+
+    dependencies = [
+        ('monitoring', '0007_latestreading'),
+    ]
+
+    operations = [
+        migrations.CreateModel(
+            name='RollupCursor',
+            fields=[
+                ('id', models.BigAutoField(auto_created=True, primary_key=True, serialize=False, verbose_name='ID')),
+                ('name', models.CharField(max_length=32, unique=True)),
+                ('last_id', models.BigIntegerField(default=0)),
+            ],
+        ),
+        migrations.CreateModel(
+            name='SensorRollup',
+            fields=[
+                ('id', models.BigAutoField(auto_created=True, primary_key=True, serialize=False, verbose_name='ID')),
+                ('sensor_type', models.CharField(choices=[('temp', 'Temperature'), ('humi', 'Humidity'), ('gas', 'Gas Level'), ('batt', 'Battery Level'), ('prox', 'Proximity/Distance'), ('motion', 'Motion/PIR'), ('diag', 'Device Diagnostics')], max_length=12)),
+                ('resolution', models.PositiveIntegerField(choices=[(60, '1 minute'), (3600, '1 hour'), (86400, '1 day')], help_text='Bucket length in seconds')),
+                ('bucket', models.DateTimeField(help_text='Start of the bucket')),
+                ('min', models.FloatField()),
+                ('max', models.FloatField()),
+                ('sum', models.FloatField()),
+                ('count', models.PositiveIntegerField()),
+                ('lunchbox', models.ForeignKey(help_text='The lunchbox these readings belong to', on_delete=django.db.models.deletion.CASCADE, related_name='rollups', to='monitoring.lunchbox')),
+            ],
+        ),
+        migrations.AddConstraint(
+            model_name='sensorrollup',
+            constraint=models.UniqueConstraint(fields=('lunchbox', 'sensor_type', 'resolution', 'bucket'), name='unique_sensor_rollup'),
+        ),
+    ]
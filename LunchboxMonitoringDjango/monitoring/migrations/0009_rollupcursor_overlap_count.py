@@ -0,0 +1,18 @@
+# Generated by Django 4.2.14 on 2026-10-14 16:00
+
+from django.db import migrations, models
+
+
+class Migration(migrations.Migration):
+
+    dependencies = [
+        ('monitoring', '0008_sensorrollup_rollupcursor'),
+    ]
+
+    operations = [
+        migrations.AddField(
+            model_name='rollupcursor',
+            name='overlap_count',
+            field=models.PositiveIntegerField(default=0, help_text='Readings seen in the ids just below last_id (rollups.OVERLAP_IDS)'),
+        ),
+    ]
@@ -0,0 +1,18 @@
+# Generated by Django 4.2.14 on 2026-10-14 18:00
+
+from django.db import migrations, models
+
+
+class Migration(migrations.Migration):
+
+    dependencies = [
+        ('monitoring', '0009_rollupcursor_overlap_count'),
+    ]
+
+    operations = [
+        migrations.AlterField(
+            model_name='alert',
+            name='alert_type',
+            field=models.CharField(choices=[('temp_high', 'Temperature Too High'), ('temp_low', 'Temperature Too Low'), ('humi_high', 'High Humidity'), ('humi_low', 'Low Humidity'), ('gas_high', 'High Gas Level'), ('batt_low', 'Low Battery'), ('prox_near', 'Object Too Near'), ('motion_detected', 'Motion Detected')], help_text='Type of alert', max_length=20),
+        ),
+    ]
@@ -1,4 +1,5 @@
 from django.db import models
+from django.utils import timezone
 from django.contrib.auth import get_user_model
 from django.core.validators import MinValueValidator, MaxValueValidator
 import uuid
@@ -24,6 +25,11 @@ class Lunchbox(models.Model):
         default=uuid.uuid4,  # stored as UUID str
         help_text="API key devices use to authenticate when pushing sensor data"
     )
+    device_config = models.JSONField(
+        default=dict,
+        blank=True,
+        help_text="Overrides of the default device config (see monitoring/device_config.py)"
+    )
     created_at = models.DateTimeField(auto_now_add=True)
     updated_at = models.DateTimeField(auto_now=True)
 
@@ -36,9 +42,12 @@ class Lunchbox(models.Model):
 
     def regenerate_api_key(self, save: bool = True):
         """Generate a new device_api_key (e.g., if compromised)."""
+        from .auth_cache import invalidate
+        old_key = self.device_api_key
         self.device_api_key = uuid.uuid4().hex
         if save:
             self.save(update_fields=["device_api_key", "updated_at"])
+            invalidate(old_key)  # the old key stops authenticating right away
         return self.device_api_key
 
 class SensorReading(models.Model):
@@ -49,6 +58,9 @@ class SensorReading(models.Model):
     BATTERY = 'batt'
     PROXIMITY = 'prox'
     MOTION = 'motion'
+    # Device self-diagnostics (firmware perf counters). `unit` names the metric,
+    # e.g. 'http_p99' (us) or 'heap_min' (bytes), so each metric graphs as its own series.
+    DIAGNOSTIC = 'diag'
     
     SENSOR_TYPES = [
         (TEMPERATURE, 'Temperature'),
@@ -57,12 +69,15 @@ class SensorReading(models.Model):
         (BATTERY, 'Battery Level'),
         (PROXIMITY, 'Proximity/Distance'),
         (MOTION, 'Motion/PIR'),
+        (DIAGNOSTIC, 'Device Diagnostics'),
     ]
 
     lunchbox = models.ForeignKey(
         Lunchbox,
         on_delete=models.CASCADE,
         related_name='sensor_readings',
+        # MySQL cannot partition a table with a foreign key, so retention.setup_partitions()
+        # drops this one when it converts the table; deletes still cascade through the ORM.
         help_text="The lunchbox this reading belongs to"
     )
     sensor_type = models.CharField(
@@ -84,6 +99,82 @@ class SensorReading(models.Model):
     def __str__(self):
         return f"{self.get_sensor_type_display()}: {self.value}{self.unit} at {self.recorded_at}"
 
+class LatestReading(models.Model):
+    """Most recent reading per (lunchbox, sensor type), kept current by the ingest path.
+
+    Current-state views (WebSocket connect, dashboard rows, status polling) read these few
+    rows instead of scanning the reading history.
+    """
+    lunchbox = models.ForeignKey(
+        Lunchbox,
+        on_delete=models.CASCADE,
+        related_name='latest_readings',
+        help_text="The lunchbox this reading belongs to"
+    )
+    sensor_type = models.CharField(max_length=12, choices=SensorReading.SENSOR_TYPES)
+    value = models.FloatField()
+    unit = models.CharField(max_length=10)
+    recorded_at = models.DateTimeField()
+
+    class Meta:
+        constraints = [
+            models.UniqueConstraint(fields=['lunchbox', 'sensor_type'], name='unique_latest_reading'),
+        ]
+
+    def __str__(self):
+        return f"{self.get_sensor_type_display()}: {self.value}{self.unit} at {self.recorded_at}"
+
+class SensorRollup(models.Model):
+    """min/max/sum/count of one sensor over one UTC-aligned time bucket.
+
+    Built from the raw readings by monitoring/rollups.py: 1-minute buckets from readings,
+    1-hour buckets from minutes, 1-day buckets from hours.
+    """
+    MINUTE = 60
+    HOUR = 3600
+    DAY = 86400
+
+    RESOLUTIONS = [
+        (MINUTE, '1 minute'),
+        (HOUR, '1 hour'),
+        (DAY, '1 day'),
+    ]
+
+    lunchbox = models.ForeignKey(
+        Lunchbox,
+        on_delete=models.CASCADE,
+        related_name='rollups',
+        help_text="The lunchbox these readings belong to"
+    )
+    sensor_type = models.CharField(max_length=12, choices=SensorReading.SENSOR_TYPES)
+    resolution = models.PositiveIntegerField(choices=RESOLUTIONS, help_text="Bucket length in seconds")
+    bucket = models.DateTimeField(help_text="Start of the bucket")
+    min = models.FloatField()
+    max = models.FloatField()
+    sum = models.FloatField()
+    count = models.PositiveIntegerField()
+
+    class Meta:
+        constraints = [
+            models.UniqueConstraint(fields=['lunchbox', 'sensor_type', 'resolution', 'bucket'],
+                                    name='unique_sensor_rollup'),
+        ]
+
+    def __str__(self):
+        return f"{self.sensor_type} x{self.count} @ {self.bucket} ({self.get_resolution_display()})"
+
+
+class RollupCursor(models.Model):
+    """Highest SensorReading id already folded into SensorRollup."""
+    name = models.CharField(max_length=32, unique=True)
+    last_id = models.BigIntegerField(default=0)
+    overlap_count = models.PositiveIntegerField(
+        default=0, help_text="Readings seen in the ids just below last_id (rollups.OVERLAP_IDS)"
+    )
+
+    def __str__(self):
+        return f"{self.name}: {self.last_id}"
+
 class Alert(models.Model):
     """Model to store alerts for abnormal conditions."""
     CRITICAL = 'critical'
@@ -99,6 +190,7 @@ class Alert(models.Model):
     TEMPERATURE_HIGH = 'temp_high'
     TEMPERATURE_LOW = 'temp_low'
     HUMIDITY_HIGH = 'humi_high'
+    HUMIDITY_LOW = 'humi_low'
     GAS_HIGH = 'gas_high'
     BATTERY_LOW = 'batt_low'
     PROXIMITY_NEAR = 'prox_near'
@@ -108,6 +200,7 @@ class Alert(models.Model):
         (TEMPERATURE_HIGH, 'Temperature Too High'),
         (TEMPERATURE_LOW, 'Temperature Too Low'),
         (HUMIDITY_HIGH, 'High Humidity'),
+        (HUMIDITY_LOW, 'Low Humidity'),
         (GAS_HIGH, 'High Gas Level'),
         (BATTERY_LOW, 'Low Battery'),
         (PROXIMITY_NEAR, 'Object Too Near'),
@@ -149,6 +242,7 @@ class Alert(models.Model):
         """Mark the alert as resolved."""
         if not self.is_resolved:
             self.is_resolved = True
+            self.resolved_at = timezone.now()
             self.save(update_fields=['is_resolved', 'resolved_at'])
             return True
         return False
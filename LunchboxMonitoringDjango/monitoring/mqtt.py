@@ -0,0 +1,106 @@
+"""MQTT uplink: the broker-side counterpart of DeviceIngestView (``manage.py mqtt_ingest``).
+
+Devices with USE_MQTT publish the same bodies they would POST, at QoS 1, on
+``<MQTT_TOPIC_PREFIX>/<client id>/up``: JSON with ``api_key``, or compact MessagePack
+(parsers.py) with the key in ``k``. Either may carry the device's config ETag in ``e``.
+Each message goes through DeviceIngestReadingSerializer and the bulk ingest (ingest.py), and
+the reply the HTTP path would return (``created``, plus ``cfg`` when the device's copy is
+stale) is published back on ``<prefix>/<client id>/down``.
+
+The subscriber uses a persistent session and acknowledges a message once it is stored, so
+messages published while the worker is down or busy are delivered when it comes back.
+"""
+import json
+import logging
+
+from django.conf import settings
+
+from .device_config import compact_config, config_etag, effective_config
+from .ingest import broadcast_batch, ingest_readings
+from .parsers import expand_compact_payload
+from .serializers import DeviceIngestReadingSerializer
+
+logger = logging.getLogger(__name__)
+
+
+def _cfg(name, default):
+    return getattr(settings, name, default)
+
+
+def topic_prefix():
+    return _cfg('MQTT_TOPIC_PREFIX', 'lunchbox')
+
+
+def decode_payload(payload):
+    """Message bytes -> (serializer data, device config ETag or None)."""
+    if payload[:1] == b'{':
+        data = json.loads(payload)
+        return data, data.pop('e', None)
+    import msgpack
+    obj = msgpack.unpackb(payload, raw=False, strict_map_key=False)
+    return expand_compact_payload(obj), obj.get('e') if isinstance(obj, dict) else None
+
+
+def handle_message(payload):
+    """Store one uplink message; returns the reply dict, or None when the message is rejected."""
+    try:
+        data, etag_seen = decode_payload(payload)
+    except Exception as exc:
+        logger.warning("MQTT uplink not decodable: %s", exc)
+        return None
+    serializer = DeviceIngestReadingSerializer(data=data)
+    if not serializer.is_valid():
+        logger.warning("MQTT uplink invalid: %s", serializer.errors)
+        return None
+    lunchbox = serializer.validated_data['lunchbox']
+    device_cfg = effective_config(lunchbox)
+    created, alerts = ingest_readings(lunchbox, serializer.validated_data['parsed_readings'], device_cfg)
+    broadcast_batch(lunchbox, created, alerts)
+    reply = {'created': len(created)}
+    if etag_seen != config_etag(device_cfg):
+        reply['cfg'] = compact_config(device_cfg)
+    return reply
+
+
+def client_id_of(topic):
+    """'<prefix>/<client id>/up' -> client id, or None for any other topic."""
+    parts = topic.split('/')
+    if len(parts) == 3 and parts[0] == topic_prefix() and parts[2] == 'up':
+        return parts[1]
+    return None
+
+
+def run(client_id='lunchbox-ingest'):
+    """Subscribe and ingest until interrupted (requires the ``paho-mqtt`` package)."""
+    import paho.mqtt.client as mqtt
+
+    prefix = topic_prefix()
+    client = mqtt.Client(client_id=client_id, clean_session=False)
+    if _cfg('MQTT_USERNAME', ''):
+        client.username_pw_set(settings.MQTT_USERNAME, _cfg('MQTT_PASSWORD', ''))
+    if _cfg('MQTT_TLS', True):
+        client.tls_set()
+
+    def on_connect(client, userdata, flags, rc):
+        if rc != 0:
+            logger.error("MQTT connect refused rc=%s", rc)
+            return
+        client.subscribe(f'{prefix}/+/up', qos=1)
+        logger.info("MQTT ingest subscribed to %s/+/up", prefix)
+
+    def on_message(client, userdata, msg):
+        device = client_id_of(msg.topic)
+        if device is None:
+            return
+        try:
+            reply = handle_message(msg.payload)
+        except Exception:
+            logger.exception("MQTT ingest failed topic=%s", msg.topic)
+            return
+        if reply is not None:
+            client.publish(f'{prefix}/{device}/down', json.dumps(reply, separators=(',', ':')), qos=1)
+
+    client.on_connect = on_connect
+    client.on_message = on_message
+    client.connect(_cfg('MQTT_BROKER_HOST', 'localhost'), _cfg('MQTT_BROKER_PORT', 8883), keepalive=60)
+    client.loop_forever()
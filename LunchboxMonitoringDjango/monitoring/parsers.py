@@ -0,0 +1,84 @@
+"""Request parsers for the device ingest endpoint.
+
+Besides plain JSON, devices may post a compact MessagePack body:
+
+    {"v": 1,
+     "t0": <base epoch seconds, 0 if the device clock is not synced>,
+     "r": [[sensor_id, dt_seconds_or_nil, value(, unit)], ...],
+     "g": {"raw": ..., "min": ..., "max": ..., "cal": "stored"|"fresh"}}   # optional gas meta
+
+The API key travels in the ``X-Device-Key`` header instead of the body, and units are
+implied by the sensor id unless a row carries its own (diagnostic rows name their metric there).  The parser normalises this into the same shape the JSON path
+produces, so DeviceIngestReadingSerializer validates both formats identically.
+"""
+from datetime import datetime, timezone as dt_timezone
+
+from rest_framework.exceptions import ParseError
+from rest_framework.parsers import BaseParser
+
+from .models import SensorReading
+
+# Must match the SensorId enum in LunchboxMonitoringWokwi/sketch.ino
+DEVICE_SENSOR_IDS = {
+    0: (SensorReading.TEMPERATURE, 'C'),
+    1: (SensorReading.HUMIDITY, '%'),
+    2: (SensorReading.GAS, 'ppm'),
+    3: (SensorReading.PROXIMITY, 'cm'),
+    4: (SensorReading.MOTION, ''),
+    5: (SensorReading.DIAGNOSTIC, ''),
+    6: (SensorReading.BATTERY, '%'),
+}
+
+
+def expand_compact_payload(obj, api_key=None):
+    """Turn a decoded compact payload into {'api_key': ..., 'readings': [...]}"""
+    if not isinstance(obj, dict) or obj.get('v') != 1:
+        raise ParseError('Unsupported compact payload version')
+    rows = obj.get('r')
+    if not isinstance(rows, (list, tuple)):
+        raise ParseError("Compact payload needs an 'r' array")
+    t0 = obj.get('t0') or 0
+    readings = []
+    for idx, row in enumerate(rows):
+        try:
+            sid, dt, value = row[0], row[1], row[2]
+            sensor_type, unit = DEVICE_SENSOR_IDS[sid]
+        except (TypeError, IndexError, KeyError):
+            raise ParseError(f'Malformed compact reading at index {idx}')
+        if len(row) > 3 and isinstance(row[3], str):
+            unit = row[3]
+        reading = {'sensor_type': sensor_type, 'value': value, 'unit': unit}
+        if t0 and dt is not None:
+            # Already a datetime: the serializer skips string parsing for these
+            reading['recorded_at'] = datetime.fromtimestamp(t0 + dt, tz=dt_timezone.utc)
+        readings.append(reading)
+    data = {'readings': readings}
+    key = obj.get('k') or api_key
+    if key:
+        data['api_key'] = key
+    if isinstance(obj.get('g'), dict):
+        data['gas_meta'] = obj['g']
+    return data
+
+
+class MessagePackParser(BaseParser):
+    """Parses the compact MessagePack ingest body (requires the ``msgpack`` package)."""
+    media_type = 'application/msgpack'
+
+    def parse(self, stream, media_type=None, parser_context=None):
+        try:
+            import msgpack
+        except ImportError:
+            raise ParseError('MessagePack support is not installed on this server')
+        try:
+            obj = msgpack.unpackb(stream.read(), raw=False, strict_map_key=False)
+        except Exception as exc:
+            raise ParseError(f'MessagePack parse error - {exc}')
+        request = (parser_context or {}).get('request')
+        api_key = request.META.get('HTTP_X_DEVICE_KEY') if request is not None else None
+        return expand_compact_payload(obj, api_key=api_key)
+
+
+class LegacyMessagePackParser(MessagePackParser):
+    """Same format under the older, still common, ``x-`` media type."""
+    media_type = 'application/x-msgpack'
@@ -0,0 +1,176 @@
+"""Retention for raw readings and minute rollups.
+
+On MySQL the SensorReading table can be RANGE-partitioned by month on ``recorded_at``
+(``manage.py reading_partitions setup``), and retention then drops whole partitions: a
+metadata change that neither locks the table for long nor leaves it bloated. Partitions
+are dropped only once their whole month is past the cutoff, so rows live up to a month
+longer than READINGS_RETENTION_DAYS.
+
+Without partitions (SQLite, or a MySQL table not converted yet) rows are deleted in small
+chunks, one (lunchbox, sensor type) at a time so every chunk is an index range, each in its
+own short transaction with a pause in between. Ingest queries interleave with the purge
+instead of waiting behind one table-wide DELETE.
+"""
+import logging
+import time
+from datetime import date, timedelta
+
+from django.conf import settings
+from django.db import connection
+from django.utils import timezone
+
+from .models import SensorReading, SensorRollup
+
+logger = logging.getLogger(__name__)
+
+TABLE = SensorReading._meta.db_table
+MAX_PARTITION = 'pmax'
+
+
+def _cfg(name, default):
+    return getattr(settings, name, default)
+
+
+# --- MySQL monthly partitions ---------------------------------------------------------
+
+def _to_days(d):
+    return d.toordinal() + 365  # MySQL TO_DAYS()
+
+
+def _next_month(d):
+    return date(d.year + d.month // 12, d.month % 12 + 1, 1)
+
+
+def _months(first, months_ahead):
+    """First days of the months from ``first`` up to ``months_ahead`` months past this one."""
+    last = timezone.now().date().replace(day=1)
+    for _ in range(months_ahead):
+        last = _next_month(last)
+    months = []
+    while first <= last:
+        months.append(first)
+        first = _next_month(first)
+    return months
+
+
+def _partition_def(month):
+    return (f"PARTITION p{month:%Y%m} VALUES LESS THAN "
+            f"(TO_DAYS('{_next_month(month):%Y-%m-%d}'))")
+
+
+def partitions():
+    """[(name, upper bound as TO_DAYS or None for MAXVALUE)] of the readings table, or []."""
+    if connection.vendor != 'mysql':
+        return []
+    with connection.cursor() as cur:
+        cur.execute(
+            "SELECT PARTITION_NAME, PARTITION_DESCRIPTION FROM information_schema.PARTITIONS "
+            "WHERE TABLE_SCHEMA = DATABASE() AND TABLE_NAME = %s AND PARTITION_NAME IS NOT NULL "
+            "ORDER BY PARTITION_ORDINAL_POSITION", [TABLE])
+        return [(name, None if desc == 'MAXVALUE' else int(desc)) for name, desc in cur.fetchall()]
+
+
+def readings_partitioned():
+    return bool(partitions())
+
+
+def setup_partitions(months_ahead=2):
+    """Convert the readings table to monthly partitions (MySQL; rewrites the table once).
+
+    MySQL requires the partition key in the primary key, so it becomes (id, recorded_at);
+    ids stay unique through AUTO_INCREMENT. Partitioned tables cannot have foreign keys, so
+    the lunchbox FK is dropped; deleting a lunchbox still cascades through the ORM.
+    """
+    if connection.vendor != 'mysql':
+        raise RuntimeError('Partitioned readings need MySQL; use the chunked purge elsewhere')
+    if readings_partitioned():
+        return []
+    with connection.cursor() as cur:
+        cur.execute(f"SELECT MIN(recorded_at) FROM {TABLE}")
+        oldest = cur.fetchone()[0]
+        months = _months((oldest.date() if oldest else timezone.now().date()).replace(day=1), months_ahead)
+        defs = ', '.join([_partition_def(m) for m in months] + [f"PARTITION {MAX_PARTITION} VALUES LESS THAN MAXVALUE"])
+        cur.execute(
+            "SELECT CONSTRAINT_NAME FROM information_schema.REFERENTIAL_CONSTRAINTS "
+            "WHERE CONSTRAINT_SCHEMA = DATABASE() AND TABLE_NAME = %s", [TABLE])
+        for (name,) in cur.fetchall():
+            cur.execute(f"ALTER TABLE {TABLE} DROP FOREIGN KEY `{name}`")
+        cur.execute(f"ALTER TABLE {TABLE} DROP PRIMARY KEY, ADD PRIMARY KEY (id, recorded_at)")
+        cur.execute(f"ALTER TABLE {TABLE} PARTITION BY RANGE (TO_DAYS(recorded_at)) ({defs})")
+    return [f"p{m:%Y%m}" for m in months]
+
+
+def ensure_partitions(months_ahead=2):
+    """Split the MAXVALUE partition so the next ``months_ahead`` months have their own."""
+    parts = partitions()
+    if not parts:
+        return []
+    bounds = [b for _, b in parts if b is not None]
+    first = date.fromordinal(max(bounds) - 365) if bounds else timezone.now().date().replace(day=1)
+    months = _months(first, months_ahead)
+    if months:
+        defs = ', '.join([_partition_def(m) for m in months] + [f"PARTITION {MAX_PARTITION} VALUES LESS THAN MAXVALUE"])
+        with connection.cursor() as cur:
+            cur.execute(f"ALTER TABLE {TABLE} REORGANIZE PARTITION {MAX_PARTITION} INTO ({defs})")
+    return [f"p{m:%Y%m}" for m in months]
+
+
+def drop_partitions_before(cutoff):
+    """Drop the partitions holding only rows older than ``cutoff``; returns their names."""
+    limit = _to_days(cutoff.date())
+    expired = [name for name, bound in partitions() if bound is not None and bound <= limit]
+    if expired:
+        with connection.cursor() as cur:
+            cur.execute(f"ALTER TABLE {TABLE} DROP PARTITION {', '.join(expired)}")
+    return expired
+
+
+# --- Chunked purge --------------------------------------------------------------------
+
+def purge_chunked(queryset, field, cutoff, chunk_size=None, pause=None):
+    """Delete rows of ``queryset`` with ``field`` < ``cutoff`` (all rows if None) in chunks.
+
+    ``queryset`` must be of a model with lunchbox and sensor_type columns leading an index.
+    Returns the number of rows deleted.
+    """
+    chunk_size = chunk_size or _cfg('PURGE_CHUNK_SIZE', 5000)
+    pause = _cfg('PURGE_CHUNK_PAUSE', 0.1) if pause is None else pause
+    model = queryset.model
+    if cutoff is not None:
+        queryset = queryset.filter(**{f'{field}__lt': cutoff})
+    pairs = list(queryset.order_by().values_list('lunchbox_id', 'sensor_type').distinct())
+    deleted = 0
+    for lunchbox_id, sensor_type in pairs:
+        rows = queryset.filter(lunchbox_id=lunchbox_id, sensor_type=sensor_type).order_by()
+        while True:
+            ids = list(rows.values_list('id', flat=True)[:chunk_size])
+            if not ids:
+                break
+            n, _ = model.objects.filter(id__in=ids).delete()
+            deleted += n
+            if len(ids) < chunk_size:
+                break
+            time.sleep(pause)
+    return deleted
+
+
+def cutoffs(now=None):
+    """(readings cutoff, minute rollups cutoff): rows older than these are purged, or due to be."""
+    now = now or timezone.now()
+    return (now - timedelta(days=_cfg('READINGS_RETENTION_DAYS', 180)),
+            now - timedelta(days=_cfg('ROLLUP_MINUTE_RETENTION_DAYS', 30)))
+
+
+def apply_retention(now=None):
+    """Expire raw readings and minute rollups; returns a summary dict for logs and commands."""
+    readings_cutoff, minutes_cutoff = cutoffs(now)
+    summary = {'cutoff': readings_cutoff.isoformat()}
+    if readings_partitioned():
+        summary['dropped_partitions'] = drop_partitions_before(readings_cutoff)
+        summary['added_partitions'] = ensure_partitions()
+    else:
+        summary['deleted_readings'] = purge_chunked(SensorReading.objects.all(), 'recorded_at', readings_cutoff)
+    summary['deleted_minute_rollups'] = purge_chunked(
+        SensorRollup.objects.filter(resolution=SensorRollup.MINUTE), 'bucket', minutes_cutoff)
+    logger.info("Retention applied: %s", summary)
+    return summary
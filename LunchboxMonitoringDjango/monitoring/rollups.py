@@ -0,0 +1,221 @@
+"""Incremental time-series rollups (SensorRollup) and the queries that read them.
+
+``roll_up_new_readings()`` (Celery beat, every minute; see tasks.py) picks up the readings
+stored since its cursor, and for the buckets they fall in recomputes 1-minute buckets from the
+raw readings, 1-hour buckets from the minutes and 1-day buckets from the hours. Rebuilding a
+touched bucket from its source (instead of adding to it) keeps late and re-sent readings
+exact and makes a run safe to repeat. Minute rollups are purged long before the readings
+(retention.py), so a late reading in an hour past their retention rebuilds it from the raw
+readings.
+
+Ids are allocated at insert but become visible at commit, so with concurrent (or queued)
+ingest a lower id can show up after the cursor has passed it. The cursor remembers how many
+readings it saw in the OVERLAP_IDS ids below it; when that count changes, the run re-reads
+that window as well.
+
+Buckets are UTC-aligned. Readers ask for a range and get it from the coarsest buckets that
+fit inside it (``covering_segments()``), so a 30-day query reads ~30 day rows plus a few hour
+and minute rows at the edges instead of every reading. Readings newer than the last run
+(at most about a minute) are not included.
+
+Devices send compressed series (``lunchbox_logic.h``), so ``sum / count`` is the mean of the
+points sent, not a time-weighted mean; min and max are those of the signal within the
+send policy's tolerance. Diagnostics and motion counts are not samples and are skipped.
+"""
+import math
+from datetime import datetime, timedelta, timezone as dt_timezone
+from functools import reduce
+from operator import or_
+
+from django.db import transaction
+from django.db.models import Max, Min, Q, Sum
+
+from . import retention
+from .ingest import upsert
+from .models import RollupCursor, SensorReading, SensorRollup
+from .series import NON_SAMPLE_UNITS
+
+MINUTE, HOUR, DAY = SensorRollup.MINUTE, SensorRollup.HOUR, SensorRollup.DAY
+
+SKIP_TYPES = {SensorReading.DIAGNOSTIC}
+
+CURSOR_NAME = 'sensor_readings'
+BATCH_SIZE = 20000  # readings per run; a backlog drains over consecutive runs
+OVERLAP_IDS = 2000  # ids below the cursor watched for readings committed late
+
+
+def floor_bucket(t, resolution):
+    ts = math.floor(t.timestamp())
+    return datetime.fromtimestamp(ts - ts % resolution, tz=dt_timezone.utc)
+
+
+def ceil_bucket(t, resolution):
+    start = floor_bucket(t, resolution)
+    return start if start == t else start + timedelta(seconds=resolution)
+
+
+def _runs(buckets, resolution):
+    """Contiguous [start, end) ranges covering a set of bucket starts."""
+    step = timedelta(seconds=resolution)
+    runs = []
+    for b in sorted(buckets):
+        if runs and runs[-1][1] == b:
+            runs[-1][1] = b + step
+        else:
+            runs.append([b, b + step])
+    return runs
+
+
+def _in_runs(field, runs):
+    return reduce(or_, (Q(**{f'{field}__gte': a, f'{field}__lt': b}) for a, b in runs))
+
+
+def _fold(items, resolution):
+    """Merge (time, min, max, sum, count) items into {bucket: [min, max, sum, count]}."""
+    out = {}
+    for t, lo, hi, total, n in items:
+        b = floor_bucket(t, resolution)
+        cur = out.get(b)
+        if cur is None:
+            out[b] = [lo, hi, total, n]
+        else:
+            cur[0] = min(cur[0], lo)
+            cur[1] = max(cur[1], hi)
+            cur[2] += total
+            cur[3] += n
+    return out
+
+
+def rebuild_buckets(lunchbox_id, sensor_type, minutes, now=None):
+    """Recompute the minute buckets ``minutes`` of one sensor and the hours/days above them.
+
+    Minute rollups outlive only ROLLUP_MINUTE_RETENTION_DAYS (retention.py): minute buckets
+    past that are not recreated, and an hour starting before it is rebuilt from the raw
+    readings instead of its (partly purged) minutes. An hour older than the raw readings'
+    retention as well keeps the row it has.
+    """
+    readings_cutoff, minutes_cutoff = retention.cutoffs(now)
+    skip_units = NON_SAMPLE_UNITS.get(sensor_type, set())
+    base = SensorRollup.objects.filter(lunchbox_id=lunchbox_id, sensor_type=sensor_type)
+    readings = (SensorReading.objects.filter(lunchbox_id=lunchbox_id, sensor_type=sensor_type)
+                .exclude(unit__in=skip_units))
+
+    def from_raw(touched, resolution):
+        return ((t, v, v, v, 1) for t, v in readings.filter(_in_runs('recorded_at', _runs(touched, resolution)))
+                .values_list('recorded_at', 'value'))
+
+    def from_rollups(touched, resolution, finer):
+        return (base.filter(_in_runs('bucket', _runs(touched, resolution)), resolution=finer)
+                .values_list('bucket', 'min', 'max', 'sum', 'count'))
+
+    def write(touched, resolution, items):
+        buckets = _fold(items, resolution)
+        if buckets:
+            upsert(SensorRollup, [
+                SensorRollup(lunchbox_id=lunchbox_id, sensor_type=sensor_type, resolution=resolution,
+                             bucket=b, min=lo, max=hi, sum=total, count=n)
+                for b, (lo, hi, total, n) in buckets.items()
+            ], ['lunchbox', 'sensor_type', 'resolution', 'bucket'], ['min', 'max', 'sum', 'count'])
+        emptied = touched - set(buckets)
+        if emptied:
+            base.filter(resolution=resolution, bucket__in=emptied).delete()
+
+    kept = {m for m in minutes if m >= minutes_cutoff}
+    if kept:
+        write(kept, MINUTE, from_raw(kept, MINUTE))
+    hours = {floor_bucket(m, HOUR) for m in minutes}
+    recent = {h for h in hours if h >= minutes_cutoff}
+    aged = {h for h in hours - recent if h >= readings_cutoff}
+    if recent:
+        write(recent, HOUR, from_rollups(recent, HOUR, MINUTE))
+    if aged:
+        write(aged, HOUR, from_raw(aged, HOUR))
+    days = {floor_bucket(h, DAY) for h in recent | aged}
+    if days:
+        write(days, DAY, from_rollups(days, DAY, HOUR))
+
+
+def _overlap_count(last_id):
+    return SensorReading.objects.filter(id__gt=last_id - OVERLAP_IDS, id__lte=last_id).count()
+
+
+def roll_up_new_readings(batch_size=BATCH_SIZE):
+    """Fold readings stored since the last run into SensorRollup; returns how many were new."""
+    with transaction.atomic():
+        cursor, _ = RollupCursor.objects.select_for_update().get_or_create(name=CURSOR_NAME)
+        seen = _overlap_count(cursor.last_id) if cursor.last_id else 0
+        rescan = seen != cursor.overlap_count  # readings below the cursor committed since
+        start = cursor.last_id - OVERLAP_IDS if rescan else cursor.last_id
+        rows = list(SensorReading.objects.filter(id__gt=start).order_by('id')
+                    .values_list('id', 'lunchbox_id', 'sensor_type', 'recorded_at')
+                    [:batch_size + cursor.last_id - start])
+        if not rows:
+            return 0
+        touched = {}
+        for _, lunchbox_id, sensor_type, recorded_at in rows:
+            if sensor_type not in SKIP_TYPES:
+                touched.setdefault((lunchbox_id, sensor_type), set()).add(floor_bucket(recorded_at, MINUTE))
+        for (lunchbox_id, sensor_type), minutes in touched.items():
+            rebuild_buckets(lunchbox_id, sensor_type, minutes)
+        new = sum(1 for row in rows if row[0] > cursor.last_id)
+        previous = cursor.overlap_count
+        cursor.last_id = max(cursor.last_id, rows[-1][0])
+        cursor.overlap_count = _overlap_count(cursor.last_id)
+        cursor.save(update_fields=['last_id', 'overlap_count'])
+    return new + max(seen - previous, 0)
+
+
+def covering_segments(start, end):
+    """Split [start, end) into (resolution, from, to) pieces: whole days, then hours, then minutes."""
+    segments = []
+
+    def cover(a, b, levels):
+        resolution, finer = levels[0], levels[1:]
+        if not finer:
+            if a < b:
+                segments.append((resolution, floor_bucket(a, resolution), b))
+            return
+        lo, hi = ceil_bucket(a, resolution), floor_bucket(b, resolution)
+        if lo >= hi:
+            cover(a, b, finer)
+            return
+        cover(a, lo, finer)
+        segments.append((resolution, lo, hi))
+        cover(hi, b, finer)
+
+    cover(start, end, (DAY, HOUR, MINUTE))
+    return segments
+
+
+def summarize(rollups, start, end):
+    """{'min', 'max', 'mean', 'count'} of a SensorRollup queryset over [start, end), one query."""
+    segments = covering_segments(start, end)
+    if not segments:
+        return {'min': None, 'max': None, 'mean': None, 'count': 0}
+    q = reduce(or_, (Q(resolution=r, bucket__gte=a, bucket__lt=b) for r, a, b in segments))
+    agg = rollups.filter(q).aggregate(min=Min('min'), max=Max('max'), sum=Sum('sum'), count=Sum('count'))
+    count = agg['count'] or 0
+    return {
+        'min': agg['min'],
+        'max': agg['max'],
+        'mean': agg['sum'] / count if count else None,
+        'count': count,
+    }
+
+
+def bucket_series(rollups, resolution, start, end, by_type=False):
+    """Rows of {'bucket', ['sensor_type',] 'min', 'max', 'mean', 'count'} of the ``resolution``
+    buckets starting in [start, end), oldest first, merged across the lunchboxes (and, unless
+    ``by_type``, the sensor types) in ``rollups``."""
+    keys = ('bucket', 'sensor_type') if by_type else ('bucket',)
+    rows = (rollups.filter(resolution=resolution, bucket__gte=start, bucket__lt=end)
+            .values(*keys)
+            .annotate(lo=Min('min'), hi=Max('max'), total=Sum('sum'), n=Sum('count'))
+            .order_by(*keys))
+    out = []
+    for r in rows:
+        row = {k: r[k] for k in keys}
+        row.update({'min': r['lo'], 'max': r['hi'], 'mean': r['total'] / r['n'] if r['n'] else None,
+                    'count': r['n']})
+        out.append(row)
+    return out
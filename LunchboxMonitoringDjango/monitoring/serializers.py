@@ -2,7 +2,9 @@ from rest_framework import serializers
 from django.contrib.auth import get_user_model
 from django.utils import timezone
 from django.utils.timezone import make_aware, is_naive
+from datetime import datetime
 from .models import Lunchbox, SensorReading, Alert
+from . import auth_cache
 
 User = get_user_model()
 
@@ -118,10 +120,10 @@ class DeviceIngestReadingSerializer(serializers.Serializer):
     def validate(self, data):
         from django.utils.dateparse import parse_datetime
         key = data['api_key']
-        try:
-            lunchbox = Lunchbox.objects.get(device_api_key=key, is_active=True)
-        except Lunchbox.DoesNotExist:
+        entry = auth_cache.lookup(key)  # cached; no query on the hot path
+        if entry is None or not entry.is_active:
             raise serializers.ValidationError({'api_key': 'Invalid or inactive device API key'})
+        lunchbox = auth_cache.lunchbox_for(entry, key)
         parsed = []
         for idx, r in enumerate(data['readings']):
             required = ['sensor_type', 'value', 'unit']  # recorded_at now optional
@@ -132,13 +134,16 @@ class DeviceIngestReadingSerializer(serializers.Serializer):
                 raise serializers.ValidationError({f'readings[{idx}].sensor_type': 'Invalid sensor type'})
 
             raw_ts = r.get('recorded_at') or ''
-            if raw_ts.endswith('Z'):
-                # Django parse_datetime prior to 5.x often fails with plain Z
-                raw_ts = raw_ts[:-1] + '+00:00'
-            if raw_ts:
+            if isinstance(raw_ts, datetime):
+                dt = raw_ts  # compact (MessagePack) bodies arrive pre-parsed
+            elif raw_ts:
+                if raw_ts.endswith('Z'):
+                    # Django parse_datetime prior to 5.x often fails with plain Z
+                    raw_ts = raw_ts[:-1] + '+00:00'
                 dt = parse_datetime(raw_ts)
                 if not dt:
                     raise serializers.ValidationError({f'readings[{idx}].recorded_at': 'Invalid datetime'})
+            if raw_ts:
                 if is_naive(dt):
                     dt = make_aware(dt, timezone=timezone.utc)
                 # Guard: if device timestamp is in the future beyond a small skew, clamp to server now
@@ -0,0 +1,101 @@
+"""Rebuild evenly spaced series from the device's compressed readings.
+
+The firmware sends each channel on its own policy (``lunchbox_logic.h``):
+
+- temperature, humidity and gas are swinging-door compressed, so the real signal stays
+  within a small band around the straight line between two consecutive points. Gas is
+  compressed on log10 of its ppm value and is interpolated geometrically;
+- proximity and motion are dead-band channels whose value holds until the next point.
+
+Every channel also sends a heartbeat point (``heartbeat_ms`` in the lunchbox's device
+config: a minute or two for most channels, ten minutes for the battery), so a silence well
+past it means the device was not reporting and the gap is left empty rather than
+interpolated across (``max_gap_for``).
+"""
+import math
+from datetime import timedelta
+
+from .models import SensorReading
+
+LINEAR = 'linear'
+LOG = 'log'
+STEP = 'step'
+
+INTERPOLATION = {
+    SensorReading.TEMPERATURE: LINEAR,
+    SensorReading.HUMIDITY: LINEAR,
+    SensorReading.GAS: LOG,
+    SensorReading.PROXIMITY: STEP,
+    SensorReading.MOTION: STEP,
+    SensorReading.BATTERY: STEP,
+}
+
+DEFAULT_MAX_GAP = timedelta(minutes=5)
+HEARTBEATS_PER_GAP = 2  # a gap is this many missed heartbeats
+
+
+def max_gap_for(config, sensor_type):
+    """Longest silence interpolated across for ``sensor_type`` under a device config."""
+    policy = config.get('channels', {}).get(sensor_type)
+    if not policy:
+        return DEFAULT_MAX_GAP
+    return max(DEFAULT_MAX_GAP, timedelta(milliseconds=HEARTBEATS_PER_GAP * policy['heartbeat_ms']))
+
+# Units marking readings that are not samples of the channel's value
+NON_SAMPLE_UNITS = {
+    SensorReading.MOTION: {'count'},  # rising edges per interval
+}
+
+
+def is_sample(sensor_type, unit):
+    """False for readings that are not a value of their channel (see NON_SAMPLE_UNITS)."""
+    return unit not in NON_SAMPLE_UNITS.get(sensor_type, ())
+
+
+def series_points(queryset, sensor_type):
+    """(recorded_at, value) samples of one sensor type, oldest first, one per timestamp."""
+    skip = NON_SAMPLE_UNITS.get(sensor_type, set())
+    points = []
+    rows = queryset.filter(sensor_type=sensor_type).order_by('recorded_at', 'id')
+    for recorded_at, value, unit in rows.values_list('recorded_at', 'value', 'unit'):
+        if unit in skip:
+            continue
+        if points and points[-1][0] == recorded_at:
+            points[-1] = (recorded_at, value)  # later reading wins (e.g. a heartbeat after an edge)
+        else:
+            points.append((recorded_at, value))
+    return points
+
+
+def _interpolate(p0, p1, t, mode):
+    (t0, v0), (t1, v1) = p0, p1
+    if mode == STEP or t1 == t0:
+        return v0
+    f = (t - t0) / (t1 - t0)
+    if mode == LOG and v0 > 0 and v1 > 0:
+        return math.exp(math.log(v0) + f * (math.log(v1) - math.log(v0)))
+    return v0 + f * (v1 - v0)
+
+
+def rebuild_series(points, start, end, step, mode=LINEAR, max_gap=DEFAULT_MAX_GAP):
+    """Sample sorted (time, value) points every ``step`` from ``start`` to ``end``.
+
+    A sample before the first point, after the last point by more than ``max_gap``, or
+    between two points more than ``max_gap`` apart is None.
+    """
+    out = []
+    i = 0
+    t = start
+    while t <= end:
+        while i + 1 < len(points) and points[i + 1][0] <= t:
+            i += 1
+        value = None
+        if points and points[i][0] <= t:
+            if i + 1 < len(points):
+                if points[i + 1][0] - points[i][0] <= max_gap:
+                    value = _interpolate(points[i], points[i + 1], t, mode)
+            elif t - points[i][0] <= max_gap:
+                value = points[i][1]
+        out.append((t, value))
+        t += step
+    return out
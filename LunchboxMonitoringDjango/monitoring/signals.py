@@ -1,56 +1,36 @@
-from django.db.models.signals import post_save
+from django.db.models.signals import post_delete, post_save
 from django.dispatch import receiver
-from django.utils import timezone
-from .models import SensorReading, Alert
+from .models import Alert, Lunchbox, SensorReading
+from .alert_rules import evaluate as evaluate_alert_rules, invalidate_state as invalidate_alert_state
+from .auth_cache import invalidate as invalidate_device_key
+from .ingest import in_bulk_ingest, update_latest
+
+
+@receiver(post_save, sender=Lunchbox)
+@receiver(post_delete, sender=Lunchbox)
+def drop_cached_device_key(sender, instance, **kwargs):
+    """is_active, owner and device_config are cached with the key; drop them on any change."""
+    invalidate_device_key(instance.device_api_key)
+    invalidate_alert_state(instance.id)  # rule tuning lives in device_config
+
+
+@receiver(post_save, sender=Alert)
+@receiver(post_delete, sender=Alert)
+def drop_cached_alert_state(sender, instance, **kwargs):
+    """An alert resolved or removed by hand; the rules engine reloads its state."""
+    invalidate_alert_state(instance.lunchbox_id)
 
-# Thresholds for alerts (in appropriate units)
-THRESHOLDS = {
-    'temp': {'min': 4.0, 'max': 60.0},  # °C
-    'humi': {'min': 20.0, 'max': 80.0},  # %
-    'gas': {'max': 1000.0},  # ppm
-}
 
 @receiver(post_save, sender=SensorReading)
 def check_sensor_reading(sender, instance, created, **kwargs):
     """
-    Check if a sensor reading exceeds thresholds and create alerts if needed.
+    Check a reading saved on its own against the alert rules (alert_rules.py) and
+    record it as the latest of its type.
+
+    Device ingest evaluates a whole batch at once inside ``bulk_ingest()``, so nothing
+    is done here in that case.
     """
-    if not created:  # Only check new readings
+    if not created or in_bulk_ingest():  # Only check new readings
         return
-    
-    sensor_type = instance.sensor_type
-    value = instance.value
-    
-    # Get thresholds for this sensor type
-    thresholds = THRESHOLDS.get(sensor_type, {})
-    
-    # Check for out-of-range conditions
-    if 'min' in thresholds and value < thresholds['min']:
-        if sensor_type == 'temp':
-            alert_type = 'temp_low'
-            severity = 'critical'
-        else:
-            alert_type = f"{sensor_type}_low"
-            severity = 'warning'
-            
-        Alert.objects.create(
-            lunchbox=instance.lunchbox,
-            alert_type=alert_type,
-            severity=severity,
-            message=f"{instance.get_sensor_type_display()} is below minimum threshold: {value}{instance.unit} < {thresholds['min']}{instance.unit}"
-        )
-    
-    elif 'max' in thresholds and value > thresholds['max']:
-        if sensor_type == 'temp':
-            alert_type = 'temp_high'
-            severity = 'critical'
-        else:
-            alert_type = f"{sensor_type}_high"
-            severity = 'warning' if sensor_type != 'gas' else 'critical'
-            
-        Alert.objects.create(
-            lunchbox=instance.lunchbox,
-            alert_type=alert_type,
-            severity=severity,
-            message=f"{instance.get_sensor_type_display()} is above maximum threshold: {value}{instance.unit} > {thresholds['max']}{instance.unit}"
-        )
+    update_latest(instance.lunchbox, [instance])
+    evaluate_alert_rules(instance.lunchbox, [instance])
@@ -0,0 +1,43 @@
+"""Celery tasks for the monitoring app (scheduled in config/celery.py)."""
+import logging
+
+from celery import shared_task
+
+from . import rollups
+
+logger = logging.getLogger(__name__)
+
+
+# No result: the django-db backend would write a row per ingested POST
+@shared_task(ignore_result=True)
+def ingest_batch(lunchbox_id, rows):
+    """Store a batch accepted with 202 by DeviceIngestView, evaluate alerts and broadcast."""
+    from .ingest import broadcast_batch, decode_batch, ingest_readings
+    from .models import Lunchbox
+    lunchbox = Lunchbox.objects.filter(id=lunchbox_id, is_active=True).first()
+    if lunchbox is None:
+        logger.warning("Queued batch dropped: lunchbox %s gone or inactive", lunchbox_id)
+        return
+    created, alerts = ingest_readings(lunchbox, decode_batch(lunchbox, rows))
+    broadcast_batch(lunchbox, created, alerts)
+
+
+@shared_task
+def roll_up_readings():
+    """Fold new readings into the minute/hour/day rollups, draining any backlog."""
+    total = 0
+    while True:
+        n = rollups.roll_up_new_readings()
+        total += n
+        if n < rollups.BATCH_SIZE:
+            break
+    if total:
+        logger.info("Rolled up %s readings", total)
+    return total
+
+
+@shared_task
+def cleanup_old_data():
+    """Nightly retention: drop expired partitions or purge in chunks (monitoring/retention.py)."""
+    from . import retention
+    return retention.apply_retention()
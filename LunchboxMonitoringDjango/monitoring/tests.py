@@ -1,7 +1,9 @@
-from django.test import TestCase
+from django.test import TestCase, override_settings
 from django.urls import reverse
 from django.contrib.auth import get_user_model
+from django.core.cache import cache
 from django.utils import timezone
+from datetime import timedelta
 from rest_framework.test import APITestCase, APIClient
 from rest_framework import status
 
@@ -171,3 +173,713 @@ class PermissionTests(APITestCase):
         url = reverse('monitoring:lunchbox-detail', args=[self.lunchbox.id])
         response = self.client.get(url)
         self.assertEqual(response.status_code, status.HTTP_401_UNAUTHORIZED)
+
+
+class DeviceIngestFormatTests(APITestCase):
+    """Test cases for the JSON and compact (MessagePack) ingest formats."""
+
+    def setUp(self):
+        self.user = User.objects.create_user(
+            email='device@example.com',
+            password='testpass123'
+        )
+        self.lunchbox = Lunchbox.objects.create(name='Device Lunchbox', owner=self.user)
+        self.url = reverse('monitoring:device-ingest')
+
+    def test_expand_compact_payload(self):
+        """Compact rows expand to the JSON reading shape with absolute timestamps."""
+        from .parsers import expand_compact_payload
+        data = expand_compact_payload(
+            {'v': 1, 't0': 1700000000, 'r': [[0, 0, 21.5], [2, 3, 140.0], [4, None, 1]]},
+            api_key='abc'
+        )
+        self.assertEqual(data['api_key'], 'abc')
+        temp, gas, motion = data['readings']
+        self.assertEqual((temp['sensor_type'], temp['unit']), ('temp', 'C'))
+        self.assertEqual(gas['recorded_at'].timestamp(), 1700000003)
+        self.assertNotIn('recorded_at', motion)
+
+    def test_expand_compact_diag_row(self):
+        """Diagnostic rows carry their metric name as the unit."""
+        from .parsers import expand_compact_payload
+        data = expand_compact_payload({'v': 1, 't0': 0, 'r': [[5, None, 812.0, 'http_p99']]})
+        self.assertEqual(data['readings'][0]['sensor_type'], SensorReading.DIAGNOSTIC)
+        self.assertEqual(data['readings'][0]['unit'], 'http_p99')
+
+    def test_expand_compact_battery_row(self):
+        """Sensor id 6 is the battery channel, in percent."""
+        from .parsers import expand_compact_payload
+        data = expand_compact_payload({'v': 1, 't0': 0, 'r': [[6, None, 87.0]]})
+        self.assertEqual((data['readings'][0]['sensor_type'], data['readings'][0]['unit']),
+                         (SensorReading.BATTERY, '%'))
+
+    def test_json_ingest(self):
+        """JSON bodies keep working."""
+        response = self.client.post(self.url, {
+            'api_key': self.lunchbox.device_api_key,
+            'readings': [{'sensor_type': 'temp', 'value': 21.5, 'unit': 'C',
+                          'recorded_at': '2025-08-16T18:30:00Z'}],
+        }, format='json')
+        self.assertEqual(response.status_code, status.HTTP_201_CREATED)
+        self.assertEqual(SensorReading.objects.filter(lunchbox=self.lunchbox).count(), 1)
+
+    def test_motion_edges_raise_alert(self):
+        """A rising then falling PIR edge in one batch still raises MOTION_DETECTED."""
+        response = self.client.post(self.url, {
+            'api_key': self.lunchbox.device_api_key,
+            'readings': [
+                {'sensor_type': 'motion', 'value': 1, 'unit': 'edge', 'recorded_at': '2025-08-16T18:30:00Z'},
+                {'sensor_type': 'motion', 'value': 0, 'unit': 'edge', 'recorded_at': '2025-08-16T18:30:01Z'},
+            ],
+        }, format='json')
+        self.assertEqual(response.status_code, status.HTTP_201_CREATED)
+        self.assertTrue(Alert.objects.filter(lunchbox=self.lunchbox, alert_type=Alert.MOTION_DETECTED).exists())
+
+    def test_ingest_reply_carries_config_until_etag_matches(self):
+        """The compact device config is sent until the device echoes its ETag."""
+        body = {
+            'api_key': self.lunchbox.device_api_key,
+            'readings': [{'sensor_type': 'temp', 'value': 21.5, 'unit': 'C'}],
+        }
+        response = self.client.post(self.url, body, format='json')
+        cfg = response.data['cfg']
+        self.assertEqual(cfg['v'], 1)
+        self.assertEqual(cfg['e'], response['ETag'])
+        self.assertEqual(len(cfg['c']), 6)
+        response = self.client.post(self.url, body, format='json', HTTP_X_CONFIG_ETAG=cfg['e'])
+        self.assertNotIn('cfg', response.data)
+
+    def test_device_config_overrides(self):
+        """Per-lunchbox overrides change both the served config and the server's alert threshold."""
+        from .device_config import compact_config, effective_config
+        self.lunchbox.device_config = {'alerts': {'temp_high': 8}, 'batch': {'flush_ms': 'x'}, 'bogus': 1}
+        self.lunchbox.save()
+        cfg = effective_config(self.lunchbox)
+        self.assertEqual(cfg['alerts']['temp_high'], 8.0)
+        self.assertEqual(cfg['batch']['flush_ms'], 2000)
+        self.assertNotIn('bogus', cfg)
+        self.assertEqual(compact_config(cfg)['a'][0], 8.0)
+        self.client.post(self.url, {
+            'api_key': self.lunchbox.device_api_key,
+            'readings': [{'sensor_type': 'temp', 'value': 9.0, 'unit': 'C'}],
+        }, format='json')
+        self.assertTrue(Alert.objects.filter(lunchbox=self.lunchbox, alert_type=Alert.TEMPERATURE_HIGH).exists())
+
+    def test_msgpack_ingest(self):
+        """MessagePack bodies with the key in X-Device-Key create the same readings."""
+        try:
+            import msgpack
+        except ImportError:
+            self.skipTest('msgpack not installed')
+        t0 = int(timezone.now().timestamp()) - 10
+        body = msgpack.packb({'v': 1, 't0': t0, 'r': [[0, 0, 21.5], [1, 1, 55.0]]})
+        response = self.client.generic(
+            'POST', self.url, body, content_type='application/msgpack',
+            HTTP_X_DEVICE_KEY=self.lunchbox.device_api_key
+        )
+        self.assertEqual(response.status_code, status.HTTP_201_CREATED)
+        humi = SensorReading.objects.get(lunchbox=self.lunchbox, sensor_type='humi')
+        self.assertEqual(humi.unit, '%')
+        self.assertEqual(int(humi.recorded_at.timestamp()), t0 + 1)
+
+
+class BulkIngestTests(APITestCase):
+    """Bulk ingest keeps queries per POST flat and alerts once per condition."""
+
+    def setUp(self):
+        self.user = User.objects.create_user(
+            email='bulk@example.com',
+            password='testpass123'
+        )
+        self.lunchbox = Lunchbox.objects.create(name='Bulk Lunchbox', owner=self.user)
+        self.url = reverse('monitoring:device-ingest')
+
+    def post_temps(self, n, value=35.0):
+        return self.client.post(self.url, {
+            'api_key': self.lunchbox.device_api_key,
+            'readings': [{'sensor_type': 'temp', 'value': value, 'unit': 'C'}] * n,
+        }, format='json')
+
+    def test_queries_per_post_do_not_grow_with_batch(self):
+        """Two readings and forty readings cost the same number of queries."""
+        self.post_temps(1)  # raises the alert both later posts reuse
+        small = self.post_temps(2)
+        large = self.post_temps(40)
+        self.assertEqual(large.status_code, status.HTTP_201_CREATED)
+        self.assertEqual(small['X-Ingest-Queries'], large['X-Ingest-Queries'])
+        self.assertEqual(SensorReading.objects.filter(lunchbox=self.lunchbox).count(), 43)
+        self.assertEqual(Alert.objects.filter(lunchbox=self.lunchbox, alert_type=Alert.TEMPERATURE_HIGH).count(), 1)
+
+    def test_single_saves_use_the_same_rules(self):
+        """A reading saved on its own alerts on the lunchbox's configured threshold."""
+        self.lunchbox.device_config = {'alerts': {'temp_high': 8}}
+        self.lunchbox.save()
+        SensorReading.objects.create(lunchbox=self.lunchbox, sensor_type='temp', value=9.0,
+                                     unit='C', recorded_at=timezone.now())
+        self.post_temps(1, value=9.5)
+        alerts = Alert.objects.filter(lunchbox=self.lunchbox, alert_type=Alert.TEMPERATURE_HIGH)
+        self.assertEqual(alerts.count(), 1)
+        self.assertEqual(alerts.first().message, 'Temperature high: 9.0C > 8.0°C')
+
+    def test_one_channel_event_per_post(self):
+        """Readings and alerts of a POST reach the WebSocket group as one sensor_batch event."""
+        import asyncio
+        from asgiref.sync import async_to_sync
+        from channels.layers import get_channel_layer
+        layer = get_channel_layer()
+        channel = async_to_sync(layer.new_channel)()
+        async_to_sync(layer.group_add)(f'lunchbox_{self.lunchbox.id}', channel)
+        self.client.post(self.url, {
+            'api_key': self.lunchbox.device_api_key,
+            'readings': [
+                {'sensor_type': 'temp', 'value': 35.0, 'unit': 'C'},
+                {'sensor_type': 'humi', 'value': 50.0, 'unit': '%'},
+                {'sensor_type': 'temp', 'value': 36.0, 'unit': 'C'},
+            ],
+        }, format='json')
+        event = async_to_sync(layer.receive)(channel)
+        self.assertEqual(event['type'], 'sensor_batch')
+        self.assertEqual([r['value'] for r in event['readings']], [36.0, 50.0])
+        self.assertEqual([a['alert_type'] for a in event['alerts']], [Alert.TEMPERATURE_HIGH])
+
+        async def nothing_more():
+            with self.assertRaises(asyncio.TimeoutError):
+                await asyncio.wait_for(layer.receive(channel), 0.1)
+        async_to_sync(nothing_more)()
+
+    def test_channel_event_skips_motion_counts(self):
+        """The sensor_batch event carries the motion level, not a trailing edge count."""
+        from .ingest import batch_event
+        now = timezone.now()
+        created = [
+            SensorReading(lunchbox=self.lunchbox, sensor_type='motion', value=0, unit='edge', recorded_at=now),
+            SensorReading(lunchbox=self.lunchbox, sensor_type='motion', value=3, unit='count', recorded_at=now),
+        ]
+        event = batch_event(created, [])
+        self.assertEqual([(r['value'], r['unit']) for r in event['readings']], [(0, 'edge')])
+
+    def test_channel_event_has_the_newest_reading(self):
+        """A spooled reading later in the POST does not replace a newer one in the event."""
+        from .ingest import batch_event
+        now = timezone.now()
+        created = [
+            SensorReading(lunchbox=self.lunchbox, sensor_type='temp', value=21.0, unit='C', recorded_at=now),
+            SensorReading(lunchbox=self.lunchbox, sensor_type='temp', value=19.0, unit='C',
+                          recorded_at=now - timedelta(minutes=5)),
+        ]
+        event = batch_event(created, [])
+        self.assertEqual([r['value'] for r in event['readings']], [21.0])
+
+    def test_motion_count_is_not_the_latest_motion(self):
+        """A trailing edge-count row leaves the motion level as the latest motion reading."""
+        from .models import LatestReading
+        self.client.post(self.url, {
+            'api_key': self.lunchbox.device_api_key,
+            'readings': [
+                {'sensor_type': 'motion', 'value': 0, 'unit': 'edge', 'recorded_at': '2025-08-16T18:30:00Z'},
+                {'sensor_type': 'motion', 'value': 3, 'unit': 'count', 'recorded_at': '2025-08-16T18:30:01Z'},
+            ],
+        }, format='json')
+        SensorReading.objects.create(lunchbox=self.lunchbox, sensor_type='motion', value=2, unit='count',
+                                     recorded_at=timezone.now())
+        latest = LatestReading.objects.get(lunchbox=self.lunchbox, sensor_type='motion')
+        self.assertEqual((latest.value, latest.unit), (0, 'edge'))
+
+    def test_latest_reading_only_moves_forward(self):
+        """A late (spooled) reading does not replace a newer latest value."""
+        from .models import LatestReading
+        for value, at in ((5.0, '2025-08-16T18:30:10Z'), (6.0, '2025-08-16T18:30:00Z')):
+            self.client.post(self.url, {
+                'api_key': self.lunchbox.device_api_key,
+                'readings': [{'sensor_type': 'temp', 'value': value, 'unit': 'C', 'recorded_at': at}],
+            }, format='json')
+        latest = LatestReading.objects.get(lunchbox=self.lunchbox, sensor_type='temp')
+        self.assertEqual(latest.value, 5.0)
+        SensorReading.objects.create(lunchbox=self.lunchbox, sensor_type='temp', value=7.0,
+                                     unit='C', recorded_at=timezone.now())
+        latest.refresh_from_db()
+        self.assertEqual(latest.value, 7.0)
+
+
+class AlertRulesTests(APITestCase):
+    """Alerts are written on state transitions only (alert_rules.py)."""
+
+    def setUp(self):
+        self.user = User.objects.create_user(
+            email='rules@example.com',
+            password='testpass123'
+        )
+        self.lunchbox = Lunchbox.objects.create(name='Rules Lunchbox', owner=self.user)
+        self.url = reverse('monitoring:device-ingest')
+        self.t0 = timezone.now() - timedelta(hours=1)
+
+    def post(self, sensor_type, unit, values, step=1):
+        with self.captureOnCommitCallbacks(execute=True):  # the state is cached on commit
+            return self.client.post(self.url, {
+                'api_key': self.lunchbox.device_api_key,
+                'readings': [
+                    {'sensor_type': sensor_type, 'value': v, 'unit': unit,
+                     'recorded_at': (self.t0 + timedelta(seconds=i * step)).isoformat()}
+                    for i, v in enumerate(values)
+                ],
+            }, format='json')
+
+    def test_hysteresis(self):
+        """Hovering at the threshold raises one alert; it resolves once past the clear band."""
+        self.post('temp', 'C', [30.5, 29.8, 30.4, 29.5, 30.2])
+        alerts = Alert.objects.filter(lunchbox=self.lunchbox, alert_type=Alert.TEMPERATURE_HIGH)
+        self.assertEqual(alerts.count(), 1)
+        self.assertFalse(alerts.get().is_resolved)
+        self.t0 += timedelta(seconds=10)
+        self.post('temp', 'C', [28.5])
+        alert = alerts.get()
+        self.assertTrue(alert.is_resolved)
+        self.assertIsNotNone(alert.resolved_at)
+
+    def test_humidity_low(self):
+        """Dry air below humi_low raises an alert; it resolves above the limit plus the clear band."""
+        self.post('humi', '%', [30.0, 18.0, 21.0])
+        alerts = Alert.objects.filter(lunchbox=self.lunchbox, alert_type=Alert.HUMIDITY_LOW)
+        self.assertEqual(alerts.count(), 1)
+        self.assertFalse(alerts.get().is_resolved)
+        self.t0 += timedelta(seconds=10)
+        self.post('humi', '%', [26.0])
+        self.assertTrue(alerts.get().is_resolved)
+
+    def test_motion_chatter_is_one_alert(self):
+        """PIR edges within the hold time are one motion alert, and cost no alert queries."""
+        self.post('motion', 'edge', [1, 0] * 10)
+        warm = self.post('motion', 'edge', [1, 0] * 10)
+        self.assertEqual(Alert.objects.filter(lunchbox=self.lunchbox, alert_type=Alert.MOTION_DETECTED).count(), 1)
+        idle = self.post('temp', 'C', [21.0])
+        self.assertEqual(warm['X-Ingest-Queries'], idle['X-Ingest-Queries'])
+        self.t0 += timedelta(minutes=10)
+        self.post('motion', 'edge', [1])
+        motion = Alert.objects.filter(lunchbox=self.lunchbox, alert_type=Alert.MOTION_DETECTED)
+        self.assertEqual(motion.count(), 2)
+        self.assertEqual(motion.filter(is_resolved=True).count(), 1)
+
+    def test_manual_resolve_reloads_state(self):
+        """After an alert is resolved by hand, a still-breaching reading raises a new one."""
+        self.post('gas', 'ppm', [250.0])
+        with self.captureOnCommitCallbacks(execute=True):
+            Alert.objects.get(lunchbox=self.lunchbox, alert_type=Alert.GAS_HIGH).resolve()
+        self.post('gas', 'ppm', [260.0])
+        self.assertEqual(Alert.objects.filter(lunchbox=self.lunchbox, alert_type=Alert.GAS_HIGH).count(), 2)
+
+    def test_state_from_a_rolled_back_ingest_is_not_cached(self):
+        """Evaluating without a commit leaves the cached state as it was."""
+        from . import alert_rules
+        reading = SensorReading(lunchbox=self.lunchbox, sensor_type='gas', value=250.0, unit='ppm',
+                                recorded_at=self.t0)
+        with self.captureOnCommitCallbacks(execute=False) as callbacks:
+            alert_rules.evaluate(self.lunchbox, [reading])
+        self.assertEqual(len(callbacks), 1)
+        self.assertIsNone(cache.get(alert_rules._state_key(self.lunchbox.id)))
+
+
+class IngestLoadTests(APITestCase):
+    """Ingest sheds load with Retry-After and asks devices for larger batches."""
+
+    def setUp(self):
+        self.user = User.objects.create_user(
+            email='load@example.com',
+            password='testpass123'
+        )
+        self.lunchbox = Lunchbox.objects.create(name='Load Lunchbox', owner=self.user)
+        self.url = reverse('monitoring:device-ingest')
+
+    def post(self, **headers):
+        return self.client.post(self.url, {
+            'api_key': self.lunchbox.device_api_key,
+            'readings': [{'sensor_type': 'temp', 'value': 21.0, 'unit': 'C'}],
+        }, format='json', **headers)
+
+    @override_settings(INGEST_CAPACITY_RATE=0.001)
+    def test_overload_is_shed_with_retry_after(self):
+        response = self.post()
+        self.assertEqual(response.status_code, status.HTTP_503_SERVICE_UNAVAILABLE)
+        self.assertGreaterEqual(int(response['Retry-After']), 1)
+        self.assertEqual(len(response.data['pace']), 2)
+        self.assertFalse(SensorReading.objects.filter(lunchbox=self.lunchbox).exists())
+        urgent = self.post(HTTP_X_DEVICE_URGENT='1')
+        self.assertEqual(urgent.status_code, status.HTTP_201_CREATED)
+
+    @override_settings(INGEST_SOFT_LOAD=0.01)
+    def test_soft_load_suggests_pace(self):
+        response = self.post()
+        self.assertEqual(response.status_code, status.HTTP_201_CREATED)
+        min_records, flush_ms = response.data['pace']
+        self.assertLessEqual(min_records, 32)
+        self.assertGreater(flush_ms, 0)
+
+    @override_settings(INGEST_CAPACITY_RATE=200, INGEST_WORKERS=4)
+    def test_process_local_cache_splits_capacity(self):
+        """On LocMemCache each worker counts only its own POSTs, so it gets its share."""
+        from .throttles import ingest_load
+        self.assertEqual(ingest_load._capacity_rate(), 50)
+
+    def test_normal_load_has_no_pace(self):
+        self.assertNotIn('pace', self.post().data)
+
+
+@override_settings(DEVICE_INGEST_ASYNC=True)
+class AsyncIngestTests(APITestCase):
+    """Async ingest replies 202 and the ingest_batch task stores the batch."""
+
+    def setUp(self):
+        self.user = User.objects.create_user(
+            email='async@example.com',
+            password='testpass123'
+        )
+        self.lunchbox = Lunchbox.objects.create(name='Async Lunchbox', owner=self.user)
+        self.url = reverse('monitoring:device-ingest')
+
+    def post(self):
+        return self.client.post(self.url, {
+            'api_key': self.lunchbox.device_api_key,
+            'readings': [
+                {'sensor_type': 'temp', 'value': 35.0, 'unit': 'C', 'recorded_at': '2025-08-16T18:30:00Z'},
+                {'sensor_type': 'humi', 'value': 50.0, 'unit': '%', 'recorded_at': '2025-08-16T18:30:00Z'},
+            ],
+        }, format='json')
+
+    def test_queued_batch_is_stored_by_the_task(self):
+        from unittest import mock
+        from .tasks import ingest_batch
+        queued = []
+        with mock.patch.object(ingest_batch, 'delay', side_effect=lambda *args: queued.append(args)):
+            response = self.post()
+        self.assertEqual(response.status_code, status.HTTP_202_ACCEPTED)
+        self.assertEqual(response.data['queued'], 2)
+        self.assertFalse(SensorReading.objects.filter(lunchbox=self.lunchbox).exists())
+        ingest_batch(*queued[0])
+        temp = SensorReading.objects.get(lunchbox=self.lunchbox, sensor_type='temp')
+        self.assertEqual(temp.recorded_at.isoformat(), '2025-08-16T18:30:00+00:00')
+        self.assertTrue(Alert.objects.filter(lunchbox=self.lunchbox, alert_type=Alert.TEMPERATURE_HIGH).exists())
+
+    def test_broker_down_stores_inline(self):
+        from unittest import mock
+        from .tasks import ingest_batch
+        with mock.patch.object(ingest_batch, 'delay', side_effect=ConnectionError('broker down')):
+            response = self.post()
+        self.assertEqual(response.status_code, status.HTTP_201_CREATED)
+        self.assertEqual(SensorReading.objects.filter(lunchbox=self.lunchbox).count(), 2)
+
+
+class MqttIngestTests(TestCase):
+    """MQTT uplink messages go through the same validation and ingest as POSTs."""
+
+    def setUp(self):
+        self.user = User.objects.create_user(
+            email='mqtt@example.com',
+            password='testpass123'
+        )
+        self.lunchbox = Lunchbox.objects.create(name='MQTT Lunchbox', owner=self.user)
+
+    def message(self, key, **extra):
+        import json
+        return json.dumps(dict({
+            'api_key': key,
+            'readings': [{'sensor_type': 'temp', 'value': 35.0, 'unit': 'C'}],
+        }, **extra)).encode()
+
+    def test_message_is_ingested_with_reply(self):
+        from . import mqtt
+        from .device_config import config_etag, effective_config
+        reply = mqtt.handle_message(self.message(self.lunchbox.device_api_key))
+        self.assertEqual(reply['created'], 1)
+        self.assertIn('cfg', reply)
+        self.assertTrue(Alert.objects.filter(lunchbox=self.lunchbox, alert_type=Alert.TEMPERATURE_HIGH).exists())
+        etag = config_etag(effective_config(self.lunchbox))
+        self.assertNotIn('cfg', mqtt.handle_message(self.message(self.lunchbox.device_api_key, e=etag)))
+
+    def test_bad_messages_are_dropped(self):
+        from . import mqtt
+        self.assertIsNone(mqtt.handle_message(self.message('not-a-key')))
+        self.assertIsNone(mqtt.handle_message(b'{not json'))
+        self.assertEqual(mqtt.client_id_of('lunchbox/lb-0a1b2c/up'), 'lb-0a1b2c')
+        self.assertIsNone(mqtt.client_id_of('lunchbox/lb-0a1b2c/down'))
+
+
+class DeviceKeyCacheTests(APITestCase):
+    """The api_key lookup is cached and dropped when the lunchbox changes."""
+
+    def setUp(self):
+        self.user = User.objects.create_user(
+            email='keys@example.com',
+            password='testpass123'
+        )
+        self.lunchbox = Lunchbox.objects.create(name='Key Lunchbox', owner=self.user)
+        self.url = reverse('monitoring:device-ingest')
+
+    def post(self, key):
+        return self.client.post(self.url, {
+            'api_key': key,
+            'readings': [{'sensor_type': 'temp', 'value': 21.5, 'unit': 'C'}],
+        }, format='json')
+
+    def test_cached_key_costs_no_query(self):
+        first = self.post(self.lunchbox.device_api_key)
+        second = self.post(self.lunchbox.device_api_key)
+        self.assertEqual(second.status_code, status.HTTP_201_CREATED)
+        self.assertEqual(int(first['X-Ingest-Queries']) - int(second['X-Ingest-Queries']), 1)
+
+    def test_regenerate_and_deactivate_invalidate(self):
+        old_key = self.lunchbox.device_api_key
+        self.assertEqual(self.post(old_key).status_code, status.HTTP_201_CREATED)
+        new_key = self.lunchbox.regenerate_api_key()
+        self.assertEqual(self.post(old_key).status_code, status.HTTP_400_BAD_REQUEST)
+        self.assertEqual(self.post(new_key).status_code, status.HTTP_201_CREATED)
+        self.lunchbox.is_active = False
+        self.lunchbox.save()
+        self.assertEqual(self.post(new_key).status_code, status.HTTP_400_BAD_REQUEST)
+
+    @override_settings(DEVICE_KEY_CACHE_TTL=300, DEVICE_KEY_LOCAL_TTL=30)
+    def test_process_local_cache_keeps_the_local_bound(self):
+        """On LocMemCache the second tier is not shared, so it gets the short TTL too."""
+        from . import auth_cache
+        self.assertEqual(auth_cache._shared_ttl(), 30)
+
+
+class SeriesTests(APITestCase):
+    """Test cases for rebuilding series from compressed device readings."""
+
+    def setUp(self):
+        self.user = User.objects.create_user(
+            email='series@example.com',
+            password='testpass123'
+        )
+        self.lunchbox = Lunchbox.objects.create(name='Series Lunchbox', owner=self.user)
+        self.t0 = timezone.now().replace(microsecond=0) - timedelta(minutes=10)
+
+    def test_linear_and_step_interpolation(self):
+        """Door-compressed channels interpolate; dead-band channels hold their value."""
+        from .series import LINEAR, STEP, rebuild_series
+        points = [(self.t0, 4.0), (self.t0 + timedelta(seconds=60), 10.0)]
+        step = timedelta(seconds=30)
+        end = self.t0 + timedelta(seconds=60)
+        self.assertEqual([v for _, v in rebuild_series(points, self.t0, end, step, mode=LINEAR)], [4.0, 7.0, 10.0])
+        self.assertEqual([v for _, v in rebuild_series(points, self.t0, end, step, mode=STEP)], [4.0, 4.0, 10.0])
+
+    def test_gap_longer_than_heartbeat_is_empty(self):
+        """No interpolation across a silence longer than max_gap, nor before the first point."""
+        from .series import rebuild_series
+        points = [(self.t0, 1.0), (self.t0 + timedelta(minutes=8), 2.0)]
+        samples = rebuild_series(points, self.t0 - timedelta(minutes=1), self.t0 + timedelta(minutes=2),
+                                 timedelta(minutes=1), max_gap=timedelta(minutes=5))
+        self.assertEqual([v for _, v in samples], [None, None, None, None])
+
+    def test_max_gap_follows_channel_heartbeat(self):
+        """Slow-heartbeat channels (battery) are not cut into gaps between heartbeats."""
+        from .device_config import DEFAULT_DEVICE_CONFIG
+        from .series import DEFAULT_MAX_GAP, max_gap_for
+        self.assertEqual(max_gap_for(DEFAULT_DEVICE_CONFIG, 'batt'), timedelta(minutes=20))
+        self.assertEqual(max_gap_for(DEFAULT_DEVICE_CONFIG, 'temp'), DEFAULT_MAX_GAP)
+
+    def test_series_endpoint_skips_motion_counts(self):
+        """Motion 'count' readings are totals, not level samples."""
+        SensorReading.objects.create(lunchbox=self.lunchbox, sensor_type='motion', value=1, unit='edge',
+                                     recorded_at=self.t0 + timedelta(minutes=9))
+        SensorReading.objects.create(lunchbox=self.lunchbox, sensor_type='motion', value=3, unit='count',
+                                     recorded_at=self.t0 + timedelta(minutes=9, seconds=30))
+        self.client.force_authenticate(user=self.user)
+        url = reverse('monitoring:sensor-series', kwargs={'lunchbox_id': self.lunchbox.id})
+        response = self.client.get(url, {'sensor_type': 'motion', 'hours': 0.25, 'step': 60})
+        self.assertEqual(response.status_code, status.HTTP_200_OK)
+        self.assertEqual(response.data['interpolation'], 'step')
+        values = [p['value'] for p in response.data['points'] if p['value'] is not None]
+        self.assertTrue(values)
+        self.assertEqual(set(values), {1.0})
+
+
+class RollupTests(TestCase):
+    """Minute/hour/day rollups match the raw readings and read back from coarse buckets."""
+
+    def setUp(self):
+        from .models import SensorRollup
+        from .rollups import floor_bucket
+        self.user = User.objects.create_user(
+            email='rollup@example.com',
+            password='testpass123'
+        )
+        self.lunchbox = Lunchbox.objects.create(name='Rollup Lunchbox', owner=self.user)
+        # Within the minute rollups' retention
+        self.t0 = floor_bucket(timezone.now() - timedelta(days=5), SensorRollup.DAY)
+        # Hourly readings over two days, plus a motion count that is not a sample
+        SensorReading.objects.bulk_create([
+            SensorReading(lunchbox=self.lunchbox, sensor_type='temp', value=float(i % 24), unit='C',
+                          recorded_at=self.t0 + timedelta(hours=i, minutes=10))
+            for i in range(48)
+        ] + [SensorReading(lunchbox=self.lunchbox, sensor_type='motion', value=7, unit='count',
+                           recorded_at=self.t0)])
+
+    def test_rollups_match_raw_readings(self):
+        from .models import SensorRollup
+        from .rollups import roll_up_new_readings, summarize
+        self.assertEqual(roll_up_new_readings(), 49)
+        temp = SensorRollup.objects.filter(lunchbox=self.lunchbox, sensor_type='temp')
+        self.assertEqual(temp.filter(resolution=SensorRollup.MINUTE).count(), 48)
+        self.assertEqual(temp.filter(resolution=SensorRollup.HOUR).count(), 48)
+        days = temp.filter(resolution=SensorRollup.DAY).order_by('bucket')
+        self.assertEqual([(d.count, d.min, d.max, d.sum) for d in days], [(24, 0.0, 23.0, 276.0)] * 2)
+        self.assertFalse(SensorRollup.objects.filter(sensor_type='motion').exists())
+        # A range of a whole day plus ragged hour edges, read from the coarsest buckets
+        stats = summarize(temp, self.t0 + timedelta(hours=20), self.t0 + timedelta(hours=46, minutes=30))
+        self.assertEqual(stats['count'], 27)  # hours 20..46 inclusive
+        self.assertEqual((stats['min'], stats['max']), (0.0, 23.0))
+
+    def test_late_reading_rebuilds_its_buckets(self):
+        from .models import SensorRollup
+        from .rollups import roll_up_new_readings
+        roll_up_new_readings()
+        SensorReading.objects.create(lunchbox=self.lunchbox, sensor_type='temp', value=-5.0, unit='C',
+                                     recorded_at=self.t0 + timedelta(minutes=10, seconds=30))
+        self.assertEqual(roll_up_new_readings(), 1)
+        self.assertEqual(roll_up_new_readings(), 0)
+        day = SensorRollup.objects.get(lunchbox=self.lunchbox, sensor_type='temp',
+                                       resolution=SensorRollup.DAY, bucket=self.t0)
+        self.assertEqual((day.count, day.min), (25, -5.0))
+
+    def test_reading_committed_below_the_cursor_is_folded(self):
+        """A lower id that becomes visible after the cursor passed it still reaches its buckets."""
+        from .models import SensorRollup
+        from .rollups import roll_up_new_readings
+        top = SensorReading.objects.order_by('-id').values_list('id', flat=True).first()
+        SensorReading.objects.create(id=top + 5, lunchbox=self.lunchbox, sensor_type='temp', value=1.0,
+                                     unit='C', recorded_at=self.t0 + timedelta(minutes=10, seconds=20))
+        roll_up_new_readings()
+        SensorReading.objects.create(id=top + 2, lunchbox=self.lunchbox, sensor_type='temp', value=-9.0,
+                                     unit='C', recorded_at=self.t0 + timedelta(minutes=10, seconds=40))
+        self.assertEqual(roll_up_new_readings(), 1)
+        self.assertEqual(roll_up_new_readings(), 0)
+        day = SensorRollup.objects.get(lunchbox=self.lunchbox, sensor_type='temp',
+                                       resolution=SensorRollup.DAY, bucket=self.t0)
+        self.assertEqual((day.count, day.min), (26, -9.0))
+
+    @override_settings(ROLLUP_MINUTE_RETENTION_DAYS=30, READINGS_RETENTION_DAYS=180)
+    def test_late_reading_past_minute_retention_rebuilds_from_raw(self):
+        """An hour whose minutes are purged is rebuilt from the readings, not from what is left."""
+        from .models import SensorRollup
+        from .rollups import floor_bucket, roll_up_new_readings
+        hour = floor_bucket(timezone.now() - timedelta(days=40), SensorRollup.HOUR)
+        SensorReading.objects.bulk_create([
+            SensorReading(lunchbox=self.lunchbox, sensor_type='humi', value=v, unit='%',
+                          recorded_at=hour + timedelta(minutes=m))
+            for m, v in ((5, 50.0), (35, 60.0))
+        ])
+        roll_up_new_readings()
+        SensorReading.objects.create(lunchbox=self.lunchbox, sensor_type='humi', value=40.0, unit='%',
+                                     recorded_at=hour + timedelta(minutes=50))
+        self.assertEqual(roll_up_new_readings(), 1)
+        humi = SensorRollup.objects.filter(lunchbox=self.lunchbox, sensor_type='humi')
+        self.assertFalse(humi.filter(resolution=SensorRollup.MINUTE).exists())
+        rollup = humi.get(resolution=SensorRollup.HOUR)
+        self.assertEqual((rollup.count, rollup.min, rollup.max), (3, 40.0, 60.0))
+        self.assertEqual(humi.get(resolution=SensorRollup.DAY).count, 3)
+
+    @override_settings(READINGS_RETENTION_DAYS=180)
+    def test_dashboard_counts_readings_within_retention(self):
+        """Day rollups outlive the readings; the dashboard total counts only the kept days."""
+        from .models import SensorRollup
+        from .rollups import floor_bucket, roll_up_new_readings
+        roll_up_new_readings()
+        SensorRollup.objects.create(lunchbox=self.lunchbox, sensor_type='temp', resolution=SensorRollup.DAY,
+                                    bucket=floor_bucket(timezone.now() - timedelta(days=200), SensorRollup.DAY),
+                                    min=1.0, max=1.0, sum=10.0, count=10)
+        client = APIClient()
+        client.force_authenticate(user=self.user)
+        response = client.get(reverse('dashboard-stats'))
+        self.assertEqual(response.status_code, status.HTTP_200_OK)
+        self.assertEqual(response.data['total_sensor_readings'], 48)
+
+
+class RetentionTests(TestCase):
+    """Expired readings go in small chunks (no partitions on the test database)."""
+
+    def setUp(self):
+        self.user = User.objects.create_user(
+            email='retention@example.com',
+            password='testpass123'
+        )
+        self.lunchbox = Lunchbox.objects.create(name='Retention Lunchbox', owner=self.user)
+        now = timezone.now()
+        SensorReading.objects.bulk_create([
+            SensorReading(lunchbox=self.lunchbox, sensor_type=st, value=1.0, unit='x',
+                          recorded_at=now - timedelta(days=days))
+            for st in ('temp', 'humi') for days in (1, 200, 201, 202, 203, 204)
+        ])
+
+    def test_chunked_purge_keeps_recent_readings(self):
+        from django.test import override_settings
+        from .retention import apply_retention
+        with override_settings(READINGS_RETENTION_DAYS=180, PURGE_CHUNK_SIZE=2, PURGE_CHUNK_PAUSE=0):
+            summary = apply_retention()
+        self.assertEqual(summary['deleted_readings'], 10)
+        self.assertEqual(SensorReading.objects.filter(lunchbox=self.lunchbox).count(), 2)
+
+
+class ExportTests(APITestCase):
+    """Streaming export walks readings in keyset order across chunk boundaries."""
+
+    def setUp(self):
+        from datetime import datetime, timezone as dt_timezone
+        self.user = User.objects.create_user(
+            email='export@example.com',
+            password='testpass123'
+        )
+        self.lunchbox = Lunchbox.objects.create(name='Export Lunchbox', owner=self.user)
+        t0 = datetime(2025, 8, 16, tzinfo=dt_timezone.utc)
+        # Pairs of readings share a timestamp, so the id tie-break matters at chunk edges
+        SensorReading.objects.bulk_create([
+            SensorReading(lunchbox=self.lunchbox, sensor_type=st, value=float(i), unit='x',
+                          recorded_at=t0 + timedelta(seconds=i // 2))
+            for st in ('temp', 'humi') for i in range(7)
+        ])
+        self.client.force_authenticate(user=self.user)
+
+    def test_keyset_chunks_return_every_row_once(self):
+        from .export import iter_readings
+        rows = list(iter_readings(self.lunchbox.id, ['temp', 'humi'], chunk_size=2))
+        self.assertEqual([(s, v) for s, _, v, _ in rows],
+                         [('temp', float(i)) for i in range(7)] + [('humi', float(i)) for i in range(7)])
+
+    def test_csv_and_ndjson_endpoint(self):
+        import json
+        url = reverse('monitoring:sensor-export', args=[self.lunchbox.id])
+        response = self.client.get(url, {'sensor_type': 'temp'})
+        self.assertEqual(response['Content-Type'], 'text/csv')
+        lines = b''.join(response.streaming_content).decode().splitlines()
+        self.assertEqual(lines[0], 'sensor_type,recorded_at,value,unit')
+        self.assertEqual(len(lines), 8)
+        response = self.client.get(url, {'fmt': 'ndjson', 'start': '2025-08-16T00:00:02Z'})
+        records = [json.loads(line) for line in b''.join(response.streaming_content).decode().splitlines()]
+        self.assertEqual(len(records), 6)  # per type: values 4, 5, 6
+        self.assertEqual(records[0]['sensor_type'], 'temp')
+
+    def test_soft_deleted_lunchbox_is_not_exported(self):
+        self.lunchbox.is_active = False
+        self.lunchbox.save(update_fields=['is_active'])
+        response = self.client.get(reverse('monitoring:sensor-export', args=[self.lunchbox.id]))
+        self.assertEqual(response.status_code, status.HTTP_404_NOT_FOUND)
+
+
+class LoadTestDeviceTests(APITestCase):
+    """The load-test fleet posts bodies the ingest accepts, the way the firmware does."""
+
+    def setUp(self):
+        self.user = User.objects.create_user(email='fleet@example.com', password='testpass123')
+        self.lunchbox = Lunchbox.objects.create(name='Fleet Lunchbox', owner=self.user)
+
+    def test_sim_device_posts_and_adopts_etag(self):
+        from .loadtest import InProcessTransport, SimDevice, Stats
+        stats = Stats()
+        device = SimDevice(self.lunchbox.id, self.lunchbox.device_api_key, 5, stats, snapshots=2, seed=1)
+        transport = InProcessTransport()
+        self.assertEqual(device.step(transport), 5)
+        self.assertIsNotNone(device.etag)
+        device.step(transport)
+        self.assertEqual(stats.status[201], 2)
+        self.assertEqual(stats.readings, 24)
+        self.assertEqual(SensorReading.objects.filter(lunchbox=self.lunchbox, sensor_type='batt').count(), 4)
+        self.assertEqual(len(stats.queries), 2)
@@ -1,27 +1,103 @@
-from rest_framework.throttling import SimpleRateThrottle
-
-
-class DeviceIngestThrottle(SimpleRateThrottle):
-    """Rate limit device ingest by device API key, falling back to client IP.
-
-    Scope name: 'device_ingest' (configure in DEFAULT_THROTTLE_RATES).
-    """
-    scope = 'device_ingest'
-
-    def get_cache_key(self, request, view):
-        # Prefer device API key from JSON body if present
-        ident = None
-        try:
-            data = getattr(request, 'data', None)
-            if isinstance(data, dict):
-                api_key = data.get('api_key') or data.get('device_api_key')
-                if api_key:
-                    ident = f"devkey:{str(api_key)}"
-        except Exception:
-            ident = None
-        if not ident:
-            ident = self.get_ident(request)  # fall back to IP
-        return self.cache_format % {
-            'scope': self.scope,
-            'ident': ident,
-        }
+import random
+import threading
+import time
+from contextlib import contextmanager
+
+from django.conf import settings
+from django.core.cache import cache, caches
+from django.core.cache.backends.locmem import LocMemCache
+from rest_framework.throttling import SimpleRateThrottle
+
+
+class DeviceIngestThrottle(SimpleRateThrottle):
+    """Rate limit device ingest by device API key, falling back to client IP.
+
+    Scope name: 'device_ingest' (configure in DEFAULT_THROTTLE_RATES). Rejections are 429s
+    with Retry-After set by DRF to the time until the device's window frees up.
+    """
+    scope = 'device_ingest'
+
+    def get_cache_key(self, request, view):
+        # Prefer device API key from JSON body if present
+        ident = None
+        try:
+            data = getattr(request, 'data', None)
+            if isinstance(data, dict):
+                api_key = data.get('api_key') or data.get('device_api_key')
+                if api_key:
+                    ident = f"devkey:{str(api_key)}"
+        except Exception:
+            ident = None
+        if not ident:
+            ident = self.get_ident(request)  # fall back to IP
+        return self.cache_format % {
+            'scope': self.scope,
+            'ident': ident,
+        }
+
+
+class IngestLoad:
+    """Load signal for device ingest, so devices back off before the tier falls over.
+
+    The level is the larger of the fleet-wide POST rate over the last ``WINDOW_S`` (a counter
+    in the shared cache, settings.CACHES) against INGEST_CAPACITY_RATE, and this worker's
+    in-flight ingests against INGEST_MAX_INFLIGHT. On the per-process LocMemCache each worker
+    only counts its own POSTs, so it is held to its share, INGEST_CAPACITY_RATE / INGEST_WORKERS. From
+    INGEST_SOFT_LOAD the reply suggests larger, slower batches (``pace``); at 1.0 POSTs
+    are shed with 503 and a jittered Retry-After, so the fleet does not retry in step.
+    """
+    WINDOW_S = 10
+    MAX_PACE = 8  # batches grow at most this many times over the configured ones
+
+    def __init__(self):
+        self._inflight = 0
+        self._lock = threading.Lock()
+
+    @staticmethod
+    def _cfg(name, default):
+        return getattr(settings, name, default)
+
+    def _window_count(self):
+        key = f'ingestload:{int(time.time()) // self.WINDOW_S}'
+        cache.add(key, 0, self.WINDOW_S * 2)
+        try:
+            return cache.incr(key)
+        except ValueError:  # evicted between add and incr
+            return 1
+
+    def _capacity_rate(self):
+        rate = self._cfg('INGEST_CAPACITY_RATE', 200.0)
+        if isinstance(caches['default'], LocMemCache):  # not shared: this worker's share only
+            rate /= max(self._cfg('INGEST_WORKERS', 1), 1)
+        return rate
+
+    @contextmanager
+    def track(self):
+        """Count one ingest in flight; yields the load level it arrived at."""
+        with self._lock:
+            self._inflight += 1
+            inflight = self._inflight
+        try:
+            rate = self._window_count() / self.WINDOW_S
+            yield max(rate / self._capacity_rate(),
+                      inflight / self._cfg('INGEST_MAX_INFLIGHT', 16))
+        finally:
+            with self._lock:
+                self._inflight -= 1
+
+    def soft(self, level):
+        return level >= self._cfg('INGEST_SOFT_LOAD', 0.7)
+
+    def retry_after(self, level):
+        """Seconds to wait, growing with the overload and spread over [base, 2 * base)."""
+        base = self._cfg('INGEST_RETRY_AFTER_S', 5) * min(level, self.MAX_PACE)
+        return int(base + random.uniform(0, base)) or 1
+
+    def pace(self, level, batch):
+        """[min_records, flush_ms] to use instead of the config's until a reply omits it."""
+        scale = min(max(level / self._cfg('INGEST_SOFT_LOAD', 0.7), 1.0), self.MAX_PACE)
+        return [min(max(int(batch['min_records'] * scale), 1), batch['max_records']),
+                int(batch['flush_ms'] * scale)]
+
+
+ingest_load = IngestLoad()
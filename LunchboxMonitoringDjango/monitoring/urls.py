@@ -20,6 +20,12 @@ urlpatterns = [
         path('lunchboxes/<int:lunchbox_id>/readings/', 
              views.SensorReadingListCreateView.as_view(), 
              name='sensor-reading-list'),
+        path('lunchboxes/<int:lunchbox_id>/series/',
+             views.SensorSeriesView.as_view(),
+             name='sensor-series'),
+        path('lunchboxes/<int:lunchbox_id>/export/',
+             views.SensorExportView.as_view(),
+             name='sensor-export'),
         
         # Alert endpoints
         path('alerts/', views.AlertListView.as_view(), name='alert-list'),
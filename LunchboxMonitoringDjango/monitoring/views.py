@@ -3,10 +3,8 @@ from rest_framework import generics, status, permissions
 from rest_framework.response import Response
 from rest_framework.views import APIView
 from django.utils import timezone
-from django.db.models import Avg, Max, Min
-from django.db.models.functions import TruncHour, TruncDay
 
-from .models import Lunchbox, SensorReading, Alert
+from .models import Lunchbox, LatestReading, SensorReading, SensorRollup, Alert
 from .serializers import (
     LunchboxSerializer, 
     SensorReadingSerializer, 
@@ -18,7 +16,13 @@ from .permissions import IsOwnerOrReadOnly
 from rest_framework.permissions import IsAuthenticated
 from rest_framework.exceptions import Throttled
 from django.conf import settings
-from .throttles import DeviceIngestThrottle
+from django.db import connection
+from .throttles import DeviceIngestThrottle, ingest_load
+from .parsers import MessagePackParser, LegacyMessagePackParser
+from .device_config import DEFAULT_DEVICE_CONFIG, compact_config, config_etag, effective_config
+from .ingest import QueryCounter, broadcast_batch, ingest_readings
+from . import rollups
+from rest_framework.parsers import JSONParser
 
 class LunchboxListCreateView(generics.ListCreateAPIView):
     """
@@ -57,16 +61,15 @@ class LunchboxDetailDataView(APIView):
     def get(self, request, lunchbox_id):
         # Ensure ownership
         lb = get_object_or_404(Lunchbox, id=lunchbox_id, owner=request.user, is_active=True)
-    # Latest readings per sensor type (DB-agnostic; avoid distinct(field) which is Postgres-only)
-        latest = {}
-        ordered = SensorReading.objects.filter(lunchbox=lb).order_by('sensor_type', '-recorded_at')
-        for r in ordered:
-            if r.sensor_type not in latest:  # first encountered is latest due to -recorded_at within sensor grouping
-                latest[r.sensor_type] = {
-                    'value': r.value,
-                    'unit': r.unit,
-                    'recorded_at': r.recorded_at.isoformat()
-                }
+        # Latest readings per sensor type (one row each, maintained by ingest)
+        latest = {
+            r.sensor_type: {
+                'value': r.value,
+                'unit': r.unit,
+                'recorded_at': r.recorded_at.isoformat()
+            }
+            for r in LatestReading.objects.filter(lunchbox=lb)
+        }
         # Recent history (last 15 readings regardless of type)
         recent_qs = SensorReading.objects.filter(lunchbox=lb).order_by('-recorded_at')[:15]
         history = [
@@ -99,16 +102,10 @@ class LunchboxStatusList(APIView):
     def get(self, request):
         lbs = Lunchbox.objects.filter(owner=request.user, is_active=True).order_by('id')
         # Fetch latest readings for all in one query
-        readings = (
-            SensorReading.objects
-            .filter(lunchbox__in=lbs)
-            .order_by('lunchbox_id', 'sensor_type', '-recorded_at')
-        )
-        latest_map = {}
-        for r in readings:
-            key = (r.lunchbox_id, r.sensor_type)
-            if key not in latest_map:  # first is latest per ordering
-                latest_map[key] = r
+        latest_map = {
+            (r.lunchbox_id, r.sensor_type): r
+            for r in LatestReading.objects.filter(lunchbox__in=lbs)
+        }
         data = []
         from django.utils.timezone import now as tznow
         current_time = tznow().isoformat()
@@ -186,6 +183,94 @@ class SensorReadingListCreateView(generics.ListCreateAPIView):
         )
 
 
+class SensorSeriesView(APIView):
+    """Evenly spaced series for one sensor, rebuilt from the device's compressed readings.
+
+    Query params: sensor_type (required), hours (default 6, max 168), step in seconds
+    (default: whatever keeps the series at or under 720 samples).
+    """
+    permission_classes = [IsAuthenticated]
+    MAX_SAMPLES = 720
+
+    def get(self, request, lunchbox_id):
+        from datetime import timedelta
+        from .device_config import effective_config
+        from .series import INTERPOLATION, LINEAR, max_gap_for, rebuild_series, series_points
+
+        lb = get_object_or_404(Lunchbox, id=lunchbox_id, owner=request.user, is_active=True)
+        params = request.query_params
+        sensor_type = params.get('sensor_type')
+        if sensor_type not in dict(SensorReading.SENSOR_TYPES):
+            return Response({'detail': 'Unknown or missing sensor_type'}, status=status.HTTP_400_BAD_REQUEST)
+        try:
+            hours = min(max(float(params.get('hours', 6)), 0.01), 168)
+            step_s = float(params['step']) if params.get('step') else 0
+        except (TypeError, ValueError):
+            return Response({'detail': 'hours and step must be numbers'}, status=status.HTTP_400_BAD_REQUEST)
+        span = timedelta(hours=hours)
+        step = max(timedelta(seconds=step_s), span / self.MAX_SAMPLES, timedelta(seconds=1))
+
+        end = timezone.now()
+        start = end - span
+        mode = INTERPOLATION.get(sensor_type, LINEAR)
+        # One point before the window so the first samples have something to interpolate from
+        qs = SensorReading.objects.filter(lunchbox=lb)
+        before = (qs.filter(sensor_type=sensor_type, recorded_at__lt=start)
+                  .order_by('-recorded_at').values_list('recorded_at', flat=True).first())
+        points = series_points(qs.filter(recorded_at__gte=before or start, recorded_at__lte=end), sensor_type)
+        samples = rebuild_series(points, start, end, step, mode=mode,
+                                 max_gap=max_gap_for(effective_config(lb), sensor_type))
+        return Response({
+            'sensor_type': sensor_type,
+            'interpolation': mode,
+            'step': step.total_seconds(),
+            'points': [{'t': t.isoformat(), 'value': v} for t, v in samples],
+        })
+
+
+class SensorExportView(APIView):
+    """Stream a lunchbox's raw readings as CSV or NDJSON (see export.py).
+
+    Query params: fmt (csv, default, or ndjson), sensor_type (repeatable or comma-separated;
+    default all), start and end (ISO8601, end exclusive). Staff can export any active lunchbox;
+    a soft-deleted one is gone here as everywhere else.
+    """
+    permission_classes = [IsAuthenticated]
+    CONTENT_TYPES = {'csv': 'text/csv', 'ndjson': 'application/x-ndjson'}
+
+    def get(self, request, lunchbox_id):
+        from django.http import StreamingHttpResponse
+        from django.utils.dateparse import parse_datetime
+        from .export import csv_stream, iter_readings, ndjson_stream
+
+        lunchboxes = Lunchbox.objects.filter(is_active=True)
+        if not request.user.is_staff:
+            lunchboxes = lunchboxes.filter(owner=request.user)
+        lb = get_object_or_404(lunchboxes, id=lunchbox_id)
+        params = request.query_params
+        fmt = params.get('fmt', 'csv')
+        if fmt not in self.CONTENT_TYPES:
+            return Response({'detail': 'fmt must be csv or ndjson'}, status=status.HTTP_400_BAD_REQUEST)
+        known = [t for t, _ in SensorReading.SENSOR_TYPES]
+        types = [t for v in params.getlist('sensor_type') for t in v.split(',') if t] or known
+        if any(t not in known for t in types):
+            return Response({'detail': 'Unknown sensor_type'}, status=status.HTTP_400_BAD_REQUEST)
+        bounds = {}
+        for name in ('start', 'end'):
+            raw = params.get(name)
+            if raw:
+                dt = parse_datetime(raw.replace('Z', '+00:00').replace(' ', '+'))
+                if not dt:
+                    return Response({'detail': f'Invalid {name}'}, status=status.HTTP_400_BAD_REQUEST)
+                bounds[name] = dt if timezone.is_aware(dt) else timezone.make_aware(dt, timezone.utc)
+
+        rows = iter_readings(lb.id, types, bounds.get('start'), bounds.get('end'))
+        body = csv_stream(rows) if fmt == 'csv' else ndjson_stream(rows)
+        response = StreamingHttpResponse(body, content_type=self.CONTENT_TYPES[fmt])
+        response['Content-Disposition'] = f'attachment; filename="lunchbox-{lb.id}-readings.{fmt}"'
+        return response
+
+
 from rest_framework.pagination import LimitOffsetPagination
 
 class AlertPagination(LimitOffsetPagination):
@@ -301,10 +386,9 @@ class DashboardView(APIView):
                 lunchbox__owner=user, 
                 is_resolved=False
             ).count(),
-            'sensor_readings_today': SensorReading.objects.filter(
-                lunchbox__owner=user,
-                recorded_at__date=timezone.now().date()
-            ).count(),
+            'sensor_readings_today': rollups.summarize(
+                SensorRollup.objects.filter(lunchbox__owner=user), self._start_of_today(), timezone.now()
+            )['count'],
         }
         
         # Add recent alerts
@@ -324,15 +408,15 @@ class DashboardView(APIView):
         serializer = DashboardStatsSerializer(data)
         return Response(serializer.data)
     
+    @staticmethod
+    def _start_of_today():
+        return timezone.localtime().replace(hour=0, minute=0, second=0, microsecond=0)
+
     def _get_sensor_statistics(self, user):
-        """Calculate statistics for sensor readings."""
-        from django.db.models import Count
-        
+        """Calculate statistics for sensor readings (from LatestReading and the hourly rollups)."""
         # Get the latest readings for each sensor type
         latest_readings = {}
-        for reading in SensorReading.objects.filter(
-            lunchbox__owner=user
-        ).order_by('sensor_type', '-recorded_at').distinct('sensor_type'):
+        for reading in LatestReading.objects.filter(lunchbox__owner=user).order_by('recorded_at'):
             latest_readings[reading.sensor_type] = {
                 'value': reading.value,
                 'unit': reading.unit,
@@ -342,24 +426,15 @@ class DashboardView(APIView):
         # Calculate daily statistics for temperature (example)
         daily_stats = {}
         if 'temp' in latest_readings:
-            today = timezone.now().date()
-            readings = SensorReading.objects.filter(
-                lunchbox__owner=user,
-                sensor_type='temp',
-                recorded_at__date=today
-            ).annotate(
-                hour=TruncHour('recorded_at')
-            ).values('hour').annotate(
-                avg_temp=Avg('value'),
-                max_temp=Max('value'),
-                min_temp=Min('value')
-            ).order_by('hour')
-            
+            hours = rollups.bucket_series(
+                SensorRollup.objects.filter(lunchbox__owner=user, sensor_type=SensorReading.TEMPERATURE),
+                SensorRollup.HOUR, self._start_of_today(), timezone.now()
+            )
             daily_stats = {
-                'labels': [r['hour'].strftime('%H:%M') for r in readings],
-                'avg_temps': [float(r['avg_temp']) for r in readings],
-                'max_temps': [float(r['max_temp']) for r in readings],
-                'min_temps': [float(r['min_temp']) for r in readings],
+                'labels': [timezone.localtime(r['bucket']).strftime('%H:%M') for r in hours],
+                'avg_temps': [float(r['mean']) for r in hours],
+                'max_temps': [float(r['max']) for r in hours],
+                'min_temps': [float(r['min']) for r in hours],
             }
         
         return {
@@ -372,14 +447,43 @@ class DeviceIngestView(APIView):
     """Endpoint for IoT devices to push sensor readings directly.
 
     Authentication: device_api_key passed in JSON body as api_key.
+    Compact MessagePack bodies (see parsers.py) carry it in the X-Device-Key header instead.
+    The reply carries the device config (device_config.py) unless X-Config-ETag already matches.
+    Under load (throttles.IngestLoad) the reply also carries ``pace``, a larger batch for the
+    device to use, and past capacity POSTs get 503 with Retry-After; the readings stay queued
+    on the device. POSTs marked X-Device-Urgent (alert crossings) are never shed.
+    With DEVICE_INGEST_ASYNC the batch is queued after validation and the reply is 202.
     This keeps device simple (single credential) and avoids per-reading auth headers.
     Throttling: uses default user anonymous throttle (optionally adjust later).
     """
     authentication_classes = []  # We'll authenticate via api_key field
     permission_classes = []
     throttle_classes = [DeviceIngestThrottle]
+    parser_classes = [JSONParser, MessagePackParser, LegacyMessagePackParser]
 
     def post(self, request):
+        with ingest_load.track() as load:
+            if load >= 1 and request.headers.get('X-Device-Urgent') != '1':
+                return self._shed(load)
+            # Queries per POST go out in X-Ingest-Queries; with bulk ingest the count does not
+            # grow with the number of readings
+            counter = QueryCounter()
+            with connection.execute_wrapper(counter):
+                response = self._ingest(request, load)
+        response['X-Ingest-Queries'] = str(counter.count)
+        return response
+
+    def _shed(self, load):
+        retry_after = ingest_load.retry_after(load)
+        response = Response({
+            'detail': 'Ingest busy, retry later',
+            'retry_after': retry_after,
+            'pace': ingest_load.pace(load, DEFAULT_DEVICE_CONFIG['batch']),
+        }, status=status.HTTP_503_SERVICE_UNAVAILABLE)
+        response['Retry-After'] = str(retry_after)
+        return response
+
+    def _ingest(self, request, load=0):
         import logging
         logger = logging.getLogger(__name__)
         # Optional shared secret header check (when configured)
@@ -399,160 +503,55 @@ class DeviceIngestView(APIView):
             logger.warning("Device ingest invalid payload ip=%s errors=%s body=%s", request.META.get('REMOTE_ADDR'), serializer.errors, raw_body)
             return Response(serializer.errors, status=status.HTTP_400_BAD_REQUEST)
 
-        created = serializer.save()
-
-        # Log source metadata
+        lunchbox = serializer.validated_data['lunchbox']
+        parsed_readings = serializer.validated_data['parsed_readings']
+        device_cfg = effective_config(lunchbox)
         remote_ip = request.META.get('REMOTE_ADDR')
         agent = request.META.get('HTTP_X_DEVICE_AGENT') or request.META.get('HTTP_USER_AGENT') or 'unknown'
-        logger.info(
-            "Device ingest: lunchbox=%s count=%s ip=%s agent=%s",
-            serializer.validated_data.get('lunchbox').id,
-            len(created),
-            remote_ip,
-            agent[:120]
-        )
 
-        # --- Simple alert threshold evaluation (initial minimal rules) ---
-        THRESHOLDS = {
-            'temp_high': 30.0,  # Celsius
-            'humi_high': 75.0,  # Percent
-            'gas_high': 200.0,  # ppm
-            'batt_low': 20.0,   # Percent
-            'prox_near': 10.0,  # cm
-        }
-        # Only (re)broadcast existing unresolved alerts if they are recent
-        from datetime import timedelta
-        recent_cutoff = timezone.now() - timedelta(hours=72)
-
-        lunchbox = serializer.validated_data.get('lunchbox')
-        alert_events = []
-        try:
-            latest_batch = {}
-            for r in created:
-                latest_batch[r.sensor_type] = r  # keep last occurrence per type in this POST
-
-            # Temperature high
-            temp_r = latest_batch.get(SensorReading.TEMPERATURE)
-            if temp_r and temp_r.value > THRESHOLDS['temp_high']:
-                existing = Alert.objects.filter(lunchbox=lunchbox, alert_type=Alert.TEMPERATURE_HIGH, is_resolved=False).order_by('-created_at').first()
-                if existing and existing.created_at >= recent_cutoff:
-                    # Broadcast existing recent alert so UI reflects current state
-                    alert_events.append(existing)
-                else:
-                    alert_events.append(Alert.objects.create(
-                        lunchbox=lunchbox,
-                        alert_type=Alert.TEMPERATURE_HIGH,
-                        severity=Alert.WARNING if temp_r.value < THRESHOLDS['temp_high'] + 5 else Alert.CRITICAL,
-                        message=f"Temperature high: {temp_r.value}{temp_r.unit} > {THRESHOLDS['temp_high']}°C"
-                    ))
-
-            # Humidity high
-            humi_r = latest_batch.get(SensorReading.HUMIDITY)
-            if humi_r and humi_r.value > THRESHOLDS['humi_high']:
-                existing = Alert.objects.filter(lunchbox=lunchbox, alert_type=Alert.HUMIDITY_HIGH, is_resolved=False).order_by('-created_at').first()
-                if existing and existing.created_at >= recent_cutoff:
-                    alert_events.append(existing)
-                else:
-                    alert_events.append(Alert.objects.create(
-                        lunchbox=lunchbox,
-                        alert_type=Alert.HUMIDITY_HIGH,
-                        severity=Alert.WARNING,
-                        message=f"Humidity high: {humi_r.value}{humi_r.unit} > {THRESHOLDS['humi_high']}%"
-                    ))
-
-            # Gas high
-            gas_r = latest_batch.get(SensorReading.GAS)
-            if gas_r and gas_r.value > THRESHOLDS['gas_high']:
-                existing = Alert.objects.filter(lunchbox=lunchbox, alert_type=Alert.GAS_HIGH, is_resolved=False).order_by('-created_at').first()
-                if existing and existing.created_at >= recent_cutoff:
-                    alert_events.append(existing)
-                else:
-                    alert_events.append(Alert.objects.create(
-                        lunchbox=lunchbox,
-                        alert_type=Alert.GAS_HIGH,
-                        severity=Alert.WARNING if gas_r.value < THRESHOLDS['gas_high'] + 100 else Alert.CRITICAL,
-                        message=f"Gas level high: {gas_r.value}{gas_r.unit} > {THRESHOLDS['gas_high']}ppm"
-                    ))
-
-            # Battery low
-            batt_r = latest_batch.get(SensorReading.BATTERY)
-            if batt_r and batt_r.value < THRESHOLDS['batt_low']:
-                existing = Alert.objects.filter(lunchbox=lunchbox, alert_type=Alert.BATTERY_LOW, is_resolved=False).order_by('-created_at').first()
-                if existing and existing.created_at >= recent_cutoff:
-                    alert_events.append(existing)
-                else:
-                    alert_events.append(Alert.objects.create(
-                        lunchbox=lunchbox,
-                        alert_type=Alert.BATTERY_LOW,
-                        severity=Alert.WARNING if batt_r.value >= THRESHOLDS['batt_low'] - 5 else Alert.CRITICAL,
-                        message=f"Battery low: {batt_r.value}{batt_r.unit} < {THRESHOLDS['batt_low']}%"
-                    ))
-
-            # Proximity near
-            prox_r = latest_batch.get(SensorReading.PROXIMITY)
-            if prox_r and prox_r.value <= THRESHOLDS['prox_near']:
-                existing = Alert.objects.filter(lunchbox=lunchbox, alert_type=Alert.PROXIMITY_NEAR, is_resolved=False).order_by('-created_at').first()
-                if existing and existing.created_at >= recent_cutoff:
-                    alert_events.append(existing)
-                else:
-                    alert_events.append(Alert.objects.create(
-                        lunchbox=lunchbox,
-                        alert_type=Alert.PROXIMITY_NEAR,
-                        severity=Alert.WARNING,
-                        message=f"Object near: {prox_r.value}{prox_r.unit or 'cm'} <= {THRESHOLDS['prox_near']}cm"
-                    ))
-
-            # Motion detected (treat any non-zero as motion)
-            motion_r = latest_batch.get(SensorReading.MOTION)
-            if motion_r and float(motion_r.value) > 0:
-                alert_events.append(Alert.objects.create(
-                    lunchbox=lunchbox,
-                    alert_type=Alert.MOTION_DETECTED,
-                    severity=Alert.WARNING,
-                    message="Motion detected"
-                ))
-        except Exception:
-            logger.exception("Alert evaluation failed lunchbox=%s", lunchbox.id if 'lunchbox' in locals() else '?')
-
-        # Broadcast last reading per sensor via channels (non-fatal if channel layer unavailable)
+        if getattr(settings, 'DEVICE_INGEST_ASYNC', False) and self._enqueue(lunchbox, parsed_readings):
+            logger.info("Device ingest queued: lunchbox=%s count=%s ip=%s agent=%s",
+                        lunchbox.id, len(parsed_readings), remote_ip, agent[:120])
+            body, code = {'queued': len(parsed_readings)}, status.HTTP_202_ACCEPTED
+        else:
+            # Alerts use the same thresholds the device pre-filters with
+            created, alert_events = ingest_readings(lunchbox, parsed_readings, device_cfg)
+
+            # Log source metadata
+            logger.info(
+                "Device ingest: lunchbox=%s count=%s alerts=%s ip=%s agent=%s",
+                lunchbox.id,
+                len(created),
+                len(alert_events),
+                remote_ip,
+                agent[:120]
+            )
+
+            broadcast_batch(lunchbox, created, alert_events)
+            body, code = {'created': len(created)}, status.HTTP_201_CREATED
+
+        # Device config rides on the reply, in full only when the device's copy is stale
+        etag = config_etag(device_cfg)
+        if request.headers.get('X-Config-ETag') != etag:
+            body['cfg'] = compact_config(device_cfg)
+        if ingest_load.soft(load):
+            body['pace'] = ingest_load.pace(load, device_cfg['batch'])
+        response = Response(body, status=code)
+        response['ETag'] = etag
+        return response
+
+    @staticmethod
+    def _enqueue(lunchbox, parsed_readings):
+        """Hand the batch to the ingest_batch task; False (ingest inline) if the broker is down."""
+        import logging
+        from .ingest import encode_batch
+        from .tasks import ingest_batch
         try:
-            from channels.layers import get_channel_layer
-            from asgiref.sync import async_to_sync
-            channel_layer = get_channel_layer()
-            if channel_layer:  # In-memory or redis layer
-                group_name = f'lunchbox_{lunchbox.id}'
-                latest_by_type = {}
-                for r in created:
-                    latest_by_type[r.sensor_type] = r
-                for r in latest_by_type.values():
-                    async_to_sync(channel_layer.group_send)(
-                        group_name,
-                        {
-                            'type': 'sensor_update',
-                            'sensor_type': r.sensor_type,
-                            'value': r.value,
-                            'unit': r.unit,
-                            'recorded_at': r.recorded_at.isoformat()
-                        }
-                    )
-                # Broadcast any alerts generated
-                for a in alert_events:
-                    logger.debug("Broadcasting alert id=%s type=%s severity=%s", a.id, a.alert_type, a.severity)
-                    async_to_sync(channel_layer.group_send)(
-                        group_name,
-                        {
-                            'type': 'alert_notification',
-                            'alert_type': a.alert_type,
-                            'severity': a.severity,
-                            'message': a.message,
-                            'created_at': a.created_at.isoformat(),
-                        }
-                    )
-        except Exception as e:  # Log and continue (avoid ingestion failure due to Redis)
-            import logging
-            logging.getLogger(__name__).warning("Channel broadcast skipped: %s", e)
-
-        return Response({'created': len(created)}, status=status.HTTP_201_CREATED)
+            ingest_batch.delay(lunchbox.id, encode_batch(parsed_readings))
+            return True
+        except Exception as e:
+            logging.getLogger(__name__).warning("Ingest queue unavailable, storing inline: %s", e)
+            return False
 
     def get(self, request):  # Simple connectivity probe (device or user can GET to verify tunnel & path)
         return Response({'detail': 'Device ingest endpoint. Use POST with api_key & readings.'}, status=status.HTTP_200_OK)
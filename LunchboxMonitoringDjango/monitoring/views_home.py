@@ -4,7 +4,7 @@ from django.contrib.auth.mixins import LoginRequiredMixin
 from django.utils import timezone
 from django.conf import settings
 from django.db.models import Max
-from .models import Lunchbox, SensorReading, Alert
+from .models import Lunchbox, LatestReading, SensorReading, Alert
 from django.utils.timesince import timesince
 from collections import defaultdict, OrderedDict
 import json
@@ -35,18 +35,10 @@ class DashboardTemplateView(LoginRequiredMixin, TemplateView):
         lunchboxes_qs = Lunchbox.objects.filter(owner=user, is_active=True).order_by('id')
 
         # Latest reading per (lunchbox, sensor_type)
-        readings = (
-            SensorReading.objects
-            .filter(lunchbox__in=lunchboxes_qs)
-            .order_by('lunchbox_id', 'sensor_type', '-recorded_at')
-        )
-        latest_readings_map = {}
-        seen_keys = set()
-        for r in readings:
-            key = (r.lunchbox_id, r.sensor_type)
-            if key not in seen_keys:
-                latest_readings_map[key] = r
-                seen_keys.add(key)
+        latest_readings_map = {
+            (r.lunchbox_id, r.sensor_type): r
+            for r in LatestReading.objects.filter(lunchbox__in=lunchboxes_qs)
+        }
 
         # Alert stats
         active_alerts = Alert.objects.filter(lunchbox__owner=user, is_resolved=False)
@@ -353,6 +353,13 @@ function handleRealtimeUpdate(data) {
     if (data.notification) {
         showToast(data.notification.message, data.notification.type || 'info');
     }
+
+    // Batched lunchbox event (one per device POST): toast the alerts it carries
+    if (data.type === 'sensor_batch') {
+        (data.alerts || []).forEach(function(alert) {
+            showToast(alert.message, alert.severity === 'critical' ? 'danger' : 'warning');
+        });
+    }
     
     // Refresh dashboard data if needed
     if (data.refresh_dashboard) {
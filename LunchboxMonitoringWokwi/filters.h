@@ -0,0 +1,125 @@
+/********************************************************
+ * Allocation-free sample filters, composed per channel in lunchbox_logic.h.
+ * Window sizes are template parameters, so every filter is a fixed-size struct with no heap
+ * use; step(x) takes one sample and returns the filtered value. NAN in is NAN out and
+ * leaves the state untouched (a failed read is not a sample).
+ ********************************************************/
+#pragma once
+#include <math.h>
+#include <stdint.h>
+
+// Last N samples, oldest overwritten first
+template<uint8_t N>
+struct RingWindow {
+  static_assert(N>0, "window needs at least one sample");
+  float   v[N];
+  uint8_t n = 0, head = 0;
+
+  void push(float x){
+    v[head] = x;
+    head = (uint8_t)((head+1) % N);
+    if(n < N) n++;
+  }
+  bool full() const { return n==N; }
+  void reset(){ n = 0; head = 0; }
+};
+
+// Median of the first n values of s; sorts s in place (insertion sort: N is small)
+inline float medianSort(float* s, uint8_t n){
+  for(uint8_t i=1;i<n;i++){
+    float y = s[i]; int j = i;
+    while(j>0 && s[j-1]>y){ s[j]=s[j-1]; j--; }
+    s[j] = y;
+  }
+  return s[n/2];
+}
+
+template<uint8_t N>
+inline float windowMedian(const RingWindow<N>& w){
+  float s[N];
+  for(uint8_t i=0;i<w.n;i++) s[i] = w.v[i];
+  return medianSort(s, w.n);
+}
+
+// Running median of the last N samples: drops isolated outliers, follows steps after N/2+1
+template<uint8_t N>
+struct MedianFilter {
+  RingWindow<N> w;
+
+  float step(float x){
+    if(isnan(x)) return NAN;
+    w.push(x);
+    return windowMedian(w);
+  }
+  void reset(){ w.reset(); }
+};
+
+/* Causal Hampel filter: a sample further than k scaled MADs from the median of the previous N
+   is replaced by that median. The raw sample still enters the window, so a real step gets
+   through once it holds the majority. The scale is floored at minScale + minRel*|median|, so a
+   flat signal (MAD 0) does not reject every small change; the floor is taken from the window,
+   never from the sample under test, so a spike cannot widen its own acceptance band. */
+template<uint8_t N>
+struct HampelFilter {
+  RingWindow<N> w;
+  float k, minScale, minRel;
+
+  explicit HampelFilter(float k_ = 3.0f, float minScale_ = 0.0f, float minRel_ = 0.0f)
+    : k(k_), minScale(minScale_), minRel(minRel_) {}
+
+  float step(float x){
+    if(isnan(x)) return NAN;
+    float out = x;
+    if(w.full()){
+      float s[N];
+      for(uint8_t i=0;i<N;i++) s[i] = w.v[i];
+      float med = medianSort(s, N);
+      for(uint8_t i=0;i<N;i++) s[i] = fabsf(w.v[i]-med);
+      float scale = 1.4826f*medianSort(s, N);  // MAD -> sigma for Gaussian noise
+      float floor = minScale + minRel*fabsf(med);
+      if(scale < floor) scale = floor;
+      if(fabsf(x-med) > k*scale) out = med;
+    }
+    w.push(x);
+    return out;
+  }
+  void reset(){ w.reset(); }
+};
+
+// S exponential moving averages in series with the same alpha; each stage seeds on its first input
+template<uint8_t S>
+struct EmaChain {
+  static_assert(S>0, "chain needs at least one stage");
+  float alpha;
+  float y[S];
+
+  explicit EmaChain(float alpha_ = 0.3f) : alpha(alpha_) { reset(); }
+
+  float step(float x){
+    if(isnan(x)) return NAN;
+    for(uint8_t i=0;i<S;i++){
+      if(isnan(y[i])) y[i] = x; else y[i] += alpha*(x-y[i]);
+      x = y[i];
+    }
+    return x;
+  }
+  void reset(){ for(uint8_t i=0;i<S;i++) y[i] = NAN; }
+};
+
+// Pass-through stage, for channels that get no filtering
+struct NoFilter {
+  float step(float x){ return x; }
+  void reset(){}
+};
+
+// Two filters in series; nest for longer chains
+template<class A, class B>
+struct FilterPipeline {
+  A a;
+  B b;
+
+  FilterPipeline(A a_ = A(), B b_ = B()) : a(a_), b(b_) {}
+
+  float step(float x){ return b.step(a.step(x)); }
+  void reset(){ a.reset(); b.reset(); }
+};
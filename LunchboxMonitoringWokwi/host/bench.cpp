@@ -0,0 +1,253 @@
+/********************************************************
+ * Host replay bench for the firmware's sensor-processing logic.
+ *
+ * Replays recorded traces (traces/NAME.csv) through lunchbox_logic.h -- the same calibration,
+ * mapping, filter pipelines, outlier guard, send policy and batch-flush code the device runs -- as
+ * fast as the CPU allows, and reports what each trace costs on the uplink (readings, POSTs)
+ * and per sample on the CPU. Any channel policy field (CHANNEL-FIELD, e.g. temp-door,
+ * gas-deadband, prox-heartbeat, prox-mingap) can be overridden or swept:
+ *
+ *   make run
+ *   ./bench --prox-deadband 3 --temp-heartbeat 120000 traces/lunch_open.csv
+ *   ./bench --sweep temp-door=0.1,0.15,0.3 traces/fridge_idle.csv traces/lunch_open.csv
+ *   ./bench --filters both traces/desk_noisy.csv # SensorFilters against the previous chain
+ ********************************************************/
+#include "lunchbox_logic.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/* Firmware cadence (mirrors sketch.ino; the trace rows are GAS_BLOCK_MS apart) */
+const unsigned long DHT_INTERVAL_MS = 2500;
+const unsigned long GAS_POLL_MS     = 300;
+const unsigned long MIN_CAPTURE_MS  = 4000;  // captureGasMin(): 120 blocks at boot
+const uint16_t      BATCH_MAX_RECORDS = 32;
+
+struct Row { unsigned long t; float temp, humi, gas, prox; int motion; };
+
+struct Trace {
+  std::string name;
+  std::vector<Row> rows;
+  bool  hasCal = false;
+  float calMin = NAN, calMax = NAN;
+};
+
+struct RunStats {
+  unsigned long durationMs = 0, calLockedAt = 0;
+  uint32_t samples = 0, sends = 0, heartbeats = 0, readings = 0, posts = 0;
+  uint32_t perChannel[CHN_COUNT] = {};
+  float gasPeak = NAN;  // highest gas ppm sent: an isolated spike that gets through shows here
+};
+
+static float cell(const std::string& s){ return s.empty() ? NAN : strtof(s.c_str(), nullptr); }
+
+static bool loadTrace(const char* path, Trace& tr){
+  std::ifstream in(path);
+  if(!in){ fprintf(stderr, "cannot open %s\n", path); return false; }
+  tr.name = path;
+  size_t slash = tr.name.find_last_of('/');
+  if(slash != std::string::npos) tr.name = tr.name.substr(slash+1);
+  std::string line;
+  while(std::getline(in, line)){
+    if(line.empty()) continue;
+    if(line[0]=='#'){
+      if(sscanf(line.c_str(), "# cal_min=%f,cal_max=%f", &tr.calMin, &tr.calMax)==2) tr.hasCal = true;
+      continue;
+    }
+    if(line.compare(0, 5, "t_ms,")==0) continue;
+    std::stringstream ss(line);
+    std::string f[6];
+    for(int i=0;i<6;i++) std::getline(ss, f[i], ',');
+    Row r;
+    r.t = strtoul(f[0].c_str(), nullptr, 10);
+    r.temp = cell(f[1]); r.humi = cell(f[2]); r.gas = cell(f[3]); r.prox = cell(f[4]);
+    r.motion = atoi(f[5].c_str());
+    tr.rows.push_back(r);
+  }
+  return !tr.rows.empty();
+}
+
+// One pass over a trace with the device's state machine; network is assumed to always succeed
+// filtered: the SensorFilters pipelines; otherwise the previous chain (spike guard, gas EMA,
+// prox median) for comparison
+static RunStats replay(const Trace& tr, const SendPolicy& pol, bool filtered){
+  RunStats st;
+  float rawMin = tr.calMin, rawMax = tr.hasCal ? tr.calMax : NAN;
+  bool  locked = tr.hasCal;
+  int   stable = 0;
+  float lut[GAS_LUT_STEPS+1], invSpan = 0;
+  if(locked){ gasLutFill(lut); invSpan = 1.0f/(rawMax-rawMin); }
+  double minAcc = 0; uint32_t minN = 0;
+  float ema = NAN, lastGoodT = NAN, lastGoodH = NAN, dhtT = NAN, dhtH = NAN;
+  unsigned long lastDht = 0, lastGasPoll = 0, lastFlush = 0;
+  bool dhtRead = false;
+  SendState ss;
+  const BatchPolicy batch;
+  SensorFilters flt;
+  MedianFilter<PROX_MEDIAN_N> pm;
+  float prox = NAN;
+  uint16_t queued = 0;
+
+  for(const Row& r : tr.rows){
+    unsigned long now = r.t;
+    st.samples++;
+    if(!locked){
+      // Boot-time MIN capture blocks the firmware: nothing else runs until it is done
+      if(isnan(rawMin)){
+        if(now < MIN_CAPTURE_MS){ minAcc += r.gas; minN++; continue; }
+        rawMin = (float)(minAcc/minN);
+      }
+      if(now - lastGasPoll >= GAS_POLL_MS){
+        lastGasPoll = now;
+        if(gasMaxStep(r.gas, rawMin, rawMax, stable)==CAL_LOCKED){
+          locked = true; st.calLockedAt = now;
+          gasLutFill(lut); invSpan = 1.0f/(rawMax-rawMin);
+        }
+      }
+    }
+    float ratio = NAN;
+    if(locked){
+      ratio = gasRatio(r.gas, rawMin, invSpan);
+      float ppm = gasLutPpm(lut, ratio);
+      if(filtered) ema = flt.gasStep(ppm); else emaStep(ema, ppm, GAS_PPM_EMA_ALPHA);
+    }
+    if(!dhtRead || now - lastDht >= DHT_INTERVAL_MS){
+      dhtRead = true; lastDht = now;
+      if(spikeAccept(r.temp, lastGoodT, TEMP_SPIKE_MAX_DIFF)) dhtT = filtered ? flt.temp.step(r.temp) : r.temp;
+      if(spikeAccept(r.humi, lastGoodH, HUMI_SPIKE_MAX_DIFF)) dhtH = filtered ? flt.humi.step(r.humi) : r.humi;
+    }
+
+    if(!isnan(r.prox)) prox = filtered ? flt.prox.step(r.prox) : pm.step(r.prox);
+
+    // Same inputs and validity checks as taskDecide(); motion edges are not modelled, so
+    // the motion channel sends level changes itself
+    // (traces carry no battery column, so batt stays silent)
+    float v[CHN_COUNT];
+    v[CHN_TEMP]   = dhtT;
+    v[CHN_HUMI]   = dhtH;
+    v[CHN_GAS]    = locked ? ema : NAN;
+    v[CHN_PROX]   = prox;
+    v[CHN_MOTION] = (float)r.motion;
+    v[CHN_BATT]   = NAN;
+    uint16_t n = 0;
+    for(int c=0;c<CHN_COUNT;c++){
+      ChannelOut o = channelStep(pol.ch[c], ss.ch[c], channelValue(c, v[c]), now);
+      n += o.n; st.perChannel[c] += o.n;
+      if(c==CHN_GAS) for(uint8_t i=0;i<o.n;i++) st.gasPeak = fmaxf(st.gasPeak, o.v[i]);
+      if(o.heartbeat) st.heartbeats += o.n;
+    }
+    if(n){ st.sends++; st.readings += n; queued += n; ss.lastSend = now; }
+    while(batchFlushDue(batch, queued, now - lastFlush)){
+      queued -= queued < BATCH_MAX_RECORDS ? queued : BATCH_MAX_RECORDS;
+      st.posts++;
+      lastFlush = now;
+      if(queued < batch.minRecords) break;
+    }
+  }
+  st.durationMs = tr.rows.back().t + (tr.rows.size()>1 ? tr.rows[1].t - tr.rows[0].t : 0);
+  return st;
+}
+
+static bool setParam(SendPolicy& p, const std::string& name, const char* val){
+  size_t dash = name.find('-');
+  if(dash==std::string::npos) return false;
+  std::string chn = name.substr(0, dash), field = name.substr(dash+1);
+  double v = atof(val);
+  for(int c=0;c<CHN_COUNT;c++){
+    if(chn!=CHANNELS[c].type) continue;
+    ChannelPolicy& cp = p.ch[c];
+    if(field=="door") cp.door = (float)v;
+    else if(field=="deadband") cp.deadband = (float)v;
+    else if(field=="heartbeat") cp.heartbeatMs = (unsigned long)v;
+    else if(field=="mingap") cp.minGapMs = (unsigned long)v;
+    else return false;
+    return true;
+  }
+  return false;
+}
+
+static void usage(){
+  fprintf(stderr,
+    "usage: bench [--CHANNEL-FIELD X]... [--repeat N] [--sweep CHANNEL-FIELD=v1,v2,...]\n"
+    "             [--filters on|off|both] trace.csv...\n"
+    "  CHANNEL: temp humi gas prox motion   FIELD: door deadband heartbeat (ms) mingap (ms)\n"
+    "  --filters off replays the previous chain (spike guard, gas EMA, prox median) instead of\n"
+    "  the SensorFilters pipelines; both prints the two, for comparing sends\n");
+}
+
+static void report(const Trace& tr, std::string label, const SendPolicy& pol, int repeat, bool filtered){
+  if(!filtered) label += " nofilt";
+  RunStats st = replay(tr, pol, filtered);
+  auto t0 = std::chrono::steady_clock::now();
+  uint32_t sink = 0;
+  for(int i=0;i<repeat;i++) sink += replay(tr, pol, filtered).posts;
+  auto t1 = std::chrono::steady_clock::now();
+  double ns = std::chrono::duration<double, std::nano>(t1-t0).count() / ((double)repeat*st.samples);
+  double hours = st.durationMs/3600000.0;
+  printf("%-16s %-26s %7.0f %6u %5u %8u %5u/%u/%u/%u/%u %8.0f %6u %8.0f %9.1f%s\n", tr.name.c_str(), label.c_str(),
+         st.durationMs/1000.0, st.sends, st.heartbeats, st.readings, st.perChannel[CHN_TEMP],
+         st.perChannel[CHN_HUMI], st.perChannel[CHN_GAS], st.perChannel[CHN_PROX], st.perChannel[CHN_MOTION],
+         st.gasPeak, st.posts, hours>0 ? st.posts/hours : 0.0, ns, sink==st.posts*(uint32_t)repeat ? "" : " (!)");
+}
+
+int main(int argc, char** argv){
+  SendPolicy base;
+  std::string sweepName;
+  std::vector<std::string> sweepVals;
+  int repeat = 200;
+  std::string filters = "on";
+  std::vector<Trace> traces;
+  for(int i=1;i<argc;i++){
+    std::string a = argv[i];
+    if(a=="-h" || a=="--help"){ usage(); return 0; }
+    if(a=="--repeat" && i+1<argc){ repeat = atoi(argv[++i]); continue; }
+    if(a=="--filters" && i+1<argc){
+      filters = argv[++i];
+      if(filters!="on" && filters!="off" && filters!="both"){ usage(); return 2; }
+      continue;
+    }
+    if(a=="--sweep" && i+1<argc){
+      std::string spec = argv[++i];
+      size_t eq = spec.find('=');
+      if(eq==std::string::npos){ usage(); return 2; }
+      sweepName = spec.substr(0, eq);
+      std::stringstream ss(spec.substr(eq+1));
+      std::string v;
+      while(std::getline(ss, v, ',')) sweepVals.push_back(v);
+      SendPolicy probe;
+      if(!setParam(probe, sweepName, "0")){ fprintf(stderr, "unknown sweep parameter %s\n", sweepName.c_str()); return 2; }
+      continue;
+    }
+    if(a.compare(0, 2, "--")==0 && i+1<argc){
+      if(!setParam(base, a.substr(2), argv[++i])){ fprintf(stderr, "unknown option %s\n", a.c_str()); return 2; }
+      continue;
+    }
+    Trace tr;
+    if(!loadTrace(argv[i], tr)) return 1;
+    traces.push_back(tr);
+  }
+  if(traces.empty()){ usage(); return 2; }
+  if(repeat < 1) repeat = 1;
+
+  printf("%-16s %-26s %7s %6s %5s %8s %-17s %8s %6s %8s %9s\n", "trace", "policy", "dur(s)", "sends", "hb",
+         "readings", "  T/H/G/P/M", "gas max", "posts", "posts/h", "ns/sample");
+  for(const Trace& tr : traces){
+    for(int f=0;f<2;f++){
+      bool filtered = f==0;
+      if(filtered ? filters=="off" : filters!="both") continue;
+      if(sweepVals.empty()){ report(tr, "default/overrides", base, repeat, filtered); continue; }
+      for(const std::string& v : sweepVals){
+        SendPolicy p = base;
+        setParam(p, sweepName, v.c_str());
+        report(tr, sweepName + "=" + v, p, repeat, filtered);
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+"""Regenerate the synthetic replay traces (deterministic: fixed seeds).
+
+Columns: t_ms,temp,humi,gas_mv,prox_cm,motion -- one row per 100 ms, matching the
+firmware's gas/prox cadence. An empty temp/humi cell is a failed DHT read. A
+leading '# cal_min=..,cal_max=..' line skips the calibration phase; without it
+the bench replays the MIN capture + MAX lock from the trace itself.
+Real recordings can be captured in the same format and dropped next to these.
+"""
+import math
+import random
+
+STEP_MS = 100
+
+
+def write(name, seconds, row_fn, cal=None, seed=1):
+    rnd = random.Random(seed)
+    with open(name, 'w') as f:
+        if cal:
+            f.write('# cal_min=%.0f,cal_max=%.0f\n' % cal)
+        f.write('t_ms,temp,humi,gas_mv,prox_cm,motion\n')
+        for i in range(seconds * 1000 // STEP_MS):
+            t = i * STEP_MS
+            temp, humi, gas, prox, motion = row_fn(t / 1000.0, rnd)
+            ts = '' if temp is None else '%.1f' % temp
+            hs = '' if humi is None else '%.1f' % humi
+            f.write('%d,%s,%s,%.0f,%.1f,%d\n' % (t, ts, hs, gas, prox, motion))
+
+
+def fridge_idle(s, rnd):
+    """Closed lunchbox in a fridge: small sensor noise, one DHT dropout and one spike."""
+    temp = 4.0 + 0.3 * math.sin(s / 90.0) + rnd.gauss(0, 0.05)
+    humi = 45.0 + rnd.gauss(0, 0.3)
+    if 120 <= s < 121:
+        temp = humi = None
+    elif 200 <= s < 200.1:
+        temp = 48.0  # single-sample spike the outlier guard must reject
+    return temp, humi, 300 + rnd.gauss(0, 4), 12.0 + rnd.gauss(0, 0.4), 0
+
+
+def lunch_open(s, rnd):
+    """Calibration at boot, then the lid opens at 60 s: warm-up, a hand over the sensor, motion."""
+    if s < 4:
+        gas = 310 + rnd.gauss(0, 3)                   # MIN capture window
+    elif s < 16:
+        gas = 2900 + rnd.gauss(0, 5)                  # slider high until MAX locks
+    else:
+        gas = 320 + rnd.gauss(0, 4)
+    if s < 60:
+        temp, humi, prox = 4.0, 45.0, 12.0
+    else:
+        k = 1 - math.exp(-(s - 60) / 60.0)
+        temp, humi = 4.0 + 18.0 * k, 45.0 + 15.0 * k
+        prox = 4.0 + 2.0 * math.sin(s * 1.3) if 60 <= s < 150 else 12.0
+    motion = 1 if (62 <= s < 90 and int(s) % 4 < 2) or 200 <= s < 215 else 0
+    return temp + rnd.gauss(0, 0.05), humi + rnd.gauss(0, 0.3), gas, prox + rnd.gauss(0, 0.4), motion
+
+
+def spoilage(s, rnd):
+    """Left out at room temperature: gas climbs steadily, everything else is quiet."""
+    gas = 300 + 2400 * (1 - math.exp(-s / 150.0)) + rnd.gauss(0, 8)
+    return 24.0 + rnd.gauss(0, 0.05), 55.0 + rnd.gauss(0, 0.3), gas, 12.0 + rnd.gauss(0, 0.4), 0
+
+
+def desk_noisy(s, rnd):
+    """On a desk with real sensor noise: ultrasonic jitter and stray echoes off a nearby object,
+    DHT reads off by a degree or two now and then, and gas blocks with occasional spikes."""
+    temp = 22.0 + rnd.gauss(0, 0.08)
+    humi = 50.0 + rnd.gauss(0, 0.4)
+    if rnd.random() < 0.08:
+        temp += rnd.choice((-1, 1)) * rnd.uniform(1.2, 2.5)
+    if rnd.random() < 0.08:
+        humi += rnd.choice((-1, 1)) * rnd.uniform(5, 10)
+    gas = 330 + rnd.gauss(0, 5)
+    if rnd.random() < 0.03:
+        gas += rnd.uniform(150, 600)
+    prox = 25.0 + rnd.gauss(0, 0.9)
+    u = rnd.random()
+    if u < 0.05:
+        prox = rnd.uniform(3, 8)        # stray echo off the edge of the desk
+    elif u < 0.08:
+        prox = rnd.uniform(150, 340)    # missed echo, read as far away
+    return temp, humi, gas, prox, 0
+
+
+def gas_spike(s, rnd):
+    """Closed box at room temperature with clean air, except for single-block gas spikes
+    (heater glitches) every ~15 s; none of them should reach the uplink."""
+    gas = 330 + rnd.gauss(0, 4)
+    if int(s * 10) % 150 == 75:
+        gas += rnd.uniform(400, 1200)
+    return 22.0 + rnd.gauss(0, 0.05), 50.0 + rnd.gauss(0, 0.3), gas, 25.0 + rnd.gauss(0, 0.4), 0
+
+
+if __name__ == '__main__':
+    write('fridge_idle.csv', 300, fridge_idle, cal=(290, 2950), seed=1)
+    write('lunch_open.csv', 300, lunch_open, seed=2)
+    write('spoilage.csv', 300, spoilage, cal=(290, 2950), seed=3)
+    write('desk_noisy.csv', 300, desk_noisy, cal=(290, 2950), seed=4)
+    write('gas_spike.csv', 300, gas_spike, cal=(290, 2950), seed=5)
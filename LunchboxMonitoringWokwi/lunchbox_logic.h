@@ -0,0 +1,272 @@
+/********************************************************
+ * Sensor-processing logic shared by sketch.ino and the host bench (host/).
+ * No Arduino or ESP-IDF dependencies: plain C++ on floats and millisecond clocks,
+ * so the exact code the device runs can be replayed and timed on Linux.
+ ********************************************************/
+#pragma once
+#include <math.h>
+#include <stdint.h>
+#include "filters.h"
+
+/* Gas calibration + mapping (values are calibrated mV, see sketch.ino) */
+const float PPM_MIN = 0.1f;
+constexpr float PPM_MAX = 100000.f;
+const float PPM_LOG_MIN = -1.0f;         // log10(PPM_MIN)
+const float PPM_LOG_MAX = 5.0f;          // log10(PPM_MAX)
+const int   STABLE_CYCLES_MAX = 25;
+const float GAS_SPAN_MIN_MV   = 25.0f;  // ~30 raw codes at 11 dB
+const int   GAS_LUT_STEPS = 256;         // ratio resolution of the ppm table (1/256 of the span)
+
+/* Smoothing / clamping */
+const float GAS_PPM_EMA_ALPHA    = 0.30f;
+const float PPM_DISPLAY_MIN      = 1.0f;
+const float PPM_DISPLAY_MAX      = 5000.0f; // compress extremes
+
+/* DHT outlier guard */
+const float TEMP_SPIKE_MAX_DIFF  = 15.0f;
+const float HUMI_SPIKE_MAX_DIFF  = 20.0f;
+
+/* Batched upload */
+const uint16_t BATCH_MIN_RECORDS  = 5;     // flush early once this many are queued
+const unsigned long BATCH_FLUSH_MS = 2000; // otherwise flush whatever is queued after this long
+
+/* Calibration state machine: MAX locks once no new peak has been seen for STABLE_CYCLES_MAX
+   polls and the span is usable. The caller persists/logs on the returned event. */
+enum CalEvent : uint8_t { CAL_NONE=0, CAL_LOCKED, CAL_SPAN_LOW };
+
+inline CalEvent gasMaxStep(float raw, float rawMin, float& rawMax, int& stableCount){
+  if(isnan(rawMax) || raw>rawMax){ rawMax=raw; stableCount=0; }
+  else stableCount++;
+  if(!isnan(rawMax) && stableCount>=STABLE_CYCLES_MAX){
+    if(rawMax - rawMin < GAS_SPAN_MIN_MV){ stableCount=0; return CAL_SPAN_LOW; }
+    return CAL_LOCKED;
+  }
+  return CAL_NONE;
+}
+
+inline float gasRatio(float raw, float rawMin, float invSpan){
+  float r=(raw-rawMin)*invSpan;
+  if(r<0) r=0;
+  if(r>1) r=1;
+  return r;
+}
+
+/* ppm table over the ratio 0..1: the log-scale curve with the display clamp applied */
+inline void gasLutFill(float lut[GAS_LUT_STEPS+1]){
+  for(int i=0;i<=GAS_LUT_STEPS;i++){
+    float ppm = powf(10.0f, PPM_LOG_MIN + (float)i/GAS_LUT_STEPS*(PPM_LOG_MAX-PPM_LOG_MIN));
+    if(ppm<PPM_DISPLAY_MIN) ppm=PPM_DISPLAY_MIN;
+    if(ppm>PPM_DISPLAY_MAX) ppm=PPM_DISPLAY_MAX;
+    lut[i]=ppm;
+  }
+}
+
+inline float gasLutPpm(const float lut[GAS_LUT_STEPS+1], float ratio){
+  float f = ratio*GAS_LUT_STEPS;
+  int i = (int)f;
+  if(i>=GAS_LUT_STEPS) return lut[GAS_LUT_STEPS];
+  return lut[i] + (lut[i+1]-lut[i])*(f-i);
+}
+
+inline void emaStep(float& ema, float x, float alpha){
+  if(isnan(ema)) ema=x; else ema += alpha*(x-ema);
+}
+
+// DHT outlier guard: accept v unless it jumps more than maxDiff from the last good value
+inline bool spikeAccept(float v, float& lastGood, float maxDiff){
+  if(isnan(v)) return false;
+  if(!isnan(lastGood) && fabsf(v-lastGood) > maxDiff) return false;
+  lastGood=v;
+  return true;
+}
+
+/* Per-channel filter pipelines (filters.h), run on each sample before the send policy.
+   - temp, humi: after the spike guard, a Hampel window over the last 5 reads, so a single
+     off read inside the guard does not go out as a point of its own
+   - gas: Hampel over the last 7 ppm blocks, then the EMA
+   - prox: running median of 5 pings (one multipath or missed echo does not move it), then a
+     light EMA so ping jitter at a dead-band edge does not send
+   - batt: a slow EMA, so the sag while the radio transmits does not read as discharge
+   Motion is a PIR level sent as edges and is not filtered. */
+const int   PROX_MEDIAN_N    = 5;
+const float DHT_HAMPEL_K     = 3.0f;
+const float TEMP_HAMPEL_MIN  = 0.3f;    // C; noise floor for the rejection band
+const float HUMI_HAMPEL_MIN  = 1.0f;    // %
+const float GAS_HAMPEL_K     = 3.0f;
+const float GAS_HAMPEL_MIN   = 0.05f;   // relative to the window median (ppm noise scales with level)
+const float PROX_EMA_ALPHA   = 0.5f;
+const float BATT_EMA_ALPHA   = 0.2f;
+
+struct SensorFilters {
+  FilterPipeline<HampelFilter<5>, NoFilter> temp{HampelFilter<5>(DHT_HAMPEL_K, TEMP_HAMPEL_MIN)};
+  FilterPipeline<HampelFilter<5>, NoFilter> humi{HampelFilter<5>(DHT_HAMPEL_K, HUMI_HAMPEL_MIN)};
+  HampelFilter<7> gasOutlier{GAS_HAMPEL_K, 0.0f, GAS_HAMPEL_MIN};
+  EmaChain<1>     gasEma{GAS_PPM_EMA_ALPHA};
+  FilterPipeline<MedianFilter<PROX_MEDIAN_N>, EmaChain<1>> prox{MedianFilter<PROX_MEDIAN_N>(), EmaChain<1>(PROX_EMA_ALPHA)};
+  EmaChain<1>     batt{BATT_EMA_ALPHA};
+
+  float gasStep(float ppm){
+    return gasEma.step(gasOutlier.step(ppm));
+  }
+};
+
+/* Per-channel send policy
+   Each channel is compressed on its own, and only channels with a point to send are queued.
+   - door > 0: swinging-door compression. A point is archived only once no straight line from
+     the last archived point passes within +-door of every sample since; the server rebuilds
+     the series by linear interpolation to within `door`. The archived point is the last
+     sample that still fit, so it goes out one sample late and carries its own time.
+   - door == 0: dead-band. A sample is sent once it is `deadband` away from the last one sent
+     (and at least minGapMs after it); the series is sample-and-hold.
+   In door mode a move of `deadband` from the last archived point skips compression and is
+   sent at once, so alert-sized steps are not held back. Any channel that has sent nothing
+   for heartbeatMs sends its current value. A logScale channel runs all of this on log10 of
+   its value (door/deadband in decades), which suits gas ppm: its noise grows with the level,
+   and the server interpolates it geometrically. */
+enum Channel : uint8_t { CHN_TEMP=0, CHN_HUMI, CHN_GAS, CHN_PROX, CHN_MOTION, CHN_BATT, CHN_COUNT };
+
+struct ChannelPolicy {
+  float door;
+  float deadband;
+  unsigned long heartbeatMs;
+  unsigned long minGapMs;  // dead-band channels only
+  bool  logScale;
+};
+
+/* Channel registry, in Channel order (also the order of the config's channel rows,
+   device_config.CHANNELS on the server), with each channel's default send policy. The sketch
+   pairs each row with where its value comes from and the sensor task that feeds it
+   (CHANNEL_SRC, which also drives the scheduler); taskDecide(), the serializers and the bench
+   iterate over these tables, so a new channel is one row here and one in CHANNEL_SRC. */
+struct ChannelDef {
+  uint8_t       sid;     // sensor id on the wire (parsers.DEVICE_SENSOR_IDS on the server)
+  const char*   type;    // server sensor_type
+  const char*   unit;
+  char          tag;     // letter in the "Send:" log; lower case = heartbeat
+  float         lo, hi;  // plausible range; anything outside is a failed read
+  ChannelPolicy policy;  // default; the server can retune it (SendPolicy)
+};
+
+constexpr ChannelDef CHANNELS[CHN_COUNT] = {
+  //                                          door  deadband heartbeat minGap  log
+  { 0, "temp",   "C",   'T', -40.0f, 125.0f, { 0.15f, 1.0f,   60000,     0, false } },
+  { 1, "humi",   "%",   'H',   0.0f, 100.0f, { 1.0f,  5.0f,   60000,     0, false } },
+  // ppm (smoothed): ~5% door, ~40% step
+  { 2, "gas",    "ppm", 'G',   0.0f, PPM_MAX, { 0.02f, 0.15f,  60000,     0, true  } },
+  { 3, "prox",   "cm",  'P',   0.0f, 400.0f, { 0.0f,  2.0f,  120000,  2000, false } },  // median
+  // level; PIR edges are sent as they happen
+  { 4, "motion", "",    'M',   0.0f,   1.0f, { 0.0f,  0.5f,  120000,     0, false } },
+  // slow: sags under radio load; 5 is 'diag' (perf counters, not a channel)
+  { 6, "batt",   "%",   'B',   0.0f, 100.0f, { 0.0f,  5.0f,  600000, 60000, false } },
+};
+
+// Channel value as the send policy sees it: NAN when unknown or out of range
+inline float channelValue(int c, float x){
+  return (!isnan(x) && x>=CHANNELS[c].lo && x<=CHANNELS[c].hi) ? x : NAN;
+}
+
+// The policy in effect: CHANNELS' defaults, spelled out so it stays a constant initializer
+// (devCfg lives in RTC memory and must not be rebuilt on every wake)
+static_assert(CHN_COUNT == 6, "SendPolicy copies one default per channel");
+struct SendPolicy {
+  ChannelPolicy ch[CHN_COUNT] = {
+    CHANNELS[CHN_TEMP].policy, CHANNELS[CHN_HUMI].policy, CHANNELS[CHN_GAS].policy,
+    CHANNELS[CHN_PROX].policy, CHANNELS[CHN_MOTION].policy, CHANNELS[CHN_BATT].policy,
+  };
+};
+
+// Values here are in the channel's domain (log10 for logScale channels)
+struct ChannelState {
+  float lastV = NAN;  unsigned long lastT = 0;    // last archived (sent) point
+  float prevV = NAN;  unsigned long prevT = 0;    // latest sample: the next archive candidate
+  float slopeHi = INFINITY, slopeLo = -INFINITY;  // open door, per ms from the archived point
+};
+
+struct SendState {
+  ChannelState ch[CHN_COUNT];
+  unsigned long lastSend = 0;  // time of the last pass that queued anything
+};
+
+struct ChannelOut {
+  uint8_t n;             // points to send, oldest first
+  float   v[2];
+  unsigned long t[2];
+  bool    heartbeat;     // sent only because heartbeatMs ran out
+};
+
+// Also used when a point went out by another path (PIR edges), so it is not sent twice
+inline void channelArchive(ChannelState& s, float v, unsigned long t){
+  s.lastV = v; s.lastT = t; s.prevV = v; s.prevT = t;
+  s.slopeHi = INFINITY; s.slopeLo = -INFINITY;
+}
+
+inline void channelPush(const ChannelPolicy& p, ChannelOut& o, ChannelState& s, float v, unsigned long t){
+  o.v[o.n] = p.logScale ? powf(10.0f, v) : v; o.t[o.n] = t; o.n++;
+  channelArchive(s, v, t);
+}
+
+inline ChannelOut channelStep(const ChannelPolicy& p, ChannelState& s, float x, unsigned long now){
+  ChannelOut o = {};
+  if(isnan(x) || (p.logScale && x<=0)) return o;
+  float v = p.logScale ? log10f(x) : x;
+  if(isnan(s.lastV)){ channelPush(p, o, s, v, now); return o; }
+  if((long)(now - s.prevT) <= 0) return o;
+  bool beat = now - s.lastT >= p.heartbeatMs;
+  bool jump = fabsf(v - s.lastV) >= p.deadband;
+  o.heartbeat = beat && !jump;
+  if(p.door <= 0){
+    if((jump && now - s.lastT >= p.minGapMs) || beat) channelPush(p, o, s, v, now);
+    return o;
+  }
+  if(jump || beat){
+    // Close the current segment at the last sample that fit, then start a new one here
+    if(s.prevT != s.lastT) channelPush(p, o, s, s.prevV, s.prevT);
+    channelPush(p, o, s, v, now);
+    return o;
+  }
+  float dt = (float)(now - s.lastT);
+  float hi = (v + p.door - s.lastV)/dt, lo = (v - p.door - s.lastV)/dt;
+  if(hi < s.slopeHi) s.slopeHi = hi;
+  if(lo > s.slopeLo) s.slopeLo = lo;
+  if(s.slopeLo > s.slopeHi){
+    // Door closed: archive the previous sample and reopen the door from it through this one
+    float pv = s.prevV; unsigned long pt = s.prevT;
+    channelPush(p, o, s, pv, pt);
+    float dt2 = (float)(now - pt);
+    s.slopeHi = (v + p.door - pv)/dt2;
+    s.slopeLo = (v - p.door - pv)/dt2;
+  }
+  o.heartbeat = false;
+  s.prevV = v; s.prevT = now;
+  return o;
+}
+
+// Send x now whatever the policy says (e.g. it just crossed an alert threshold), closing
+// any open door segment first
+inline ChannelOut channelForce(const ChannelPolicy& p, ChannelState& s, float x, unsigned long now){
+  ChannelOut o = {};
+  if(isnan(x) || (p.logScale && x<=0)) return o;
+  float v = p.logScale ? log10f(x) : x;
+  if(!isnan(s.lastV) && s.prevT != s.lastT && (long)(now - s.prevT) > 0) channelPush(p, o, s, s.prevV, s.prevT);
+  channelPush(p, o, s, v, now);
+  return o;
+}
+
+// Uplink: send once enough is queued, or when the oldest unsent batch has waited long enough
+struct BatchPolicy {
+  uint16_t minRecords = BATCH_MIN_RECORDS;
+  unsigned long flushMs = BATCH_FLUSH_MS;
+};
+
+inline bool batchFlushDue(const BatchPolicy& p, uint16_t queued, unsigned long sinceFlushMs){
+  return queued && (queued>=p.minRecords || sinceFlushMs>=p.flushMs);
+}
+
+// Wait before retrying a failed POST: the server's Retry-After when it sent one (stretched by
+// up to a quarter), else the exponential backoff (between half and all of it). rnd is any
+// uniform random word; the spread keeps devices that failed together from retrying together.
+inline unsigned long retryDelayMs(unsigned long backoffMs, unsigned long hintMs, uint32_t rnd){
+  unsigned long base = hintMs ? hintMs : backoffMs;
+  unsigned long spread = hintMs ? base/4 : base/2;
+  return (hintMs ? base : base - spread) + rnd % (spread + 1);
+}
@@ -4,10 +4,17 @@
 #include <WiFi.h>
 #include <WiFiClientSecure.h>
 #include <HTTPClient.h>
+#include <MQTT.h>
 #include <ArduinoJson.h>
 #include <DHT.h>
 #include <Preferences.h>
 #include <esp_system.h>
+#include <esp_timer.h>
+#include <esp_sleep.h>
+#include <esp_pm.h>
+#include <driver/gpio.h>
+#include <sys/time.h>
+#include "lunchbox_logic.h"  // calibration, mapping, smoothing, change detection (also built by host/)
 #include <time.h>
 
 /* -------- User Config -------- */
@@ -20,10 +27,35 @@ const char* INGEST_PATH    = "/api/ingest/device/";
 const char* DEVICE_API_KEY = "625dc0bb-bfcb-4887-a194-2c20546b48bd";
 const char* WIFI_SSID      = "Wokwi-GUEST";
 const char* WIFI_PASS      = "";
+// Compact MessagePack batches (key in X-Device-Key, integer sensor ids, t0 + offsets);
+// the server needs the msgpack package installed. false = plain JSON.
+bool        USE_MSGPACK    = false;
+// MQTT uplink instead of HTTP POSTs: one persistent TLS session, batches published at QoS 1
+// (server side: manage.py mqtt_ingest). Replies (config, pace) arrive on <prefix>/<id>/down.
+bool        USE_MQTT       = false;
+const char* MQTT_HOST      = "mqtt.example.com";
+const uint16_t MQTT_PORT   = 8883;
+const char* MQTT_USER      = "";
+const char* MQTT_PASS      = "";
+const char* MQTT_CLIENT_ID = "lunchbox-1";  // unique per device; the broker keeps its session
+const char* MQTT_TOPIC_PREFIX = "lunchbox";
+
+/* Power mode
+   POWER_ACTIVE: always awake (mains / USB).
+   POWER_LIGHT : light sleep between samples, Wi-Fi modem sleep, slower polling.
+   POWER_DEEP  : one sample (+ upload when enough is queued) per wake, then deep sleep until
+                 the timer or the PIR (GPIO 27, ext0) wakes the chip. */
+enum PowerMode : uint8_t { POWER_ACTIVE=0, POWER_LIGHT, POWER_DEEP };
+PowerMode   POWER_MODE     = POWER_ACTIVE;
 
 /* Recalibration control */
 bool FORCE_RECAL = false;
 
+/* Fast boot: no DHT warmup, no 5 s serial window, Wi-Fi from the NVS cache (BSSID/channel/
+   static IP) and SNTP in the background. false = the original blocking bring-up.
+   With fast boot, recalibrate with the 'R' command or by holding BOOT for 3 s. */
+bool FAST_BOOT = true;
+
 /* Sensors */
 #define DHTPIN 26
 #define DHTTYPE DHT22
@@ -32,64 +64,262 @@ bool FORCE_RECAL = false;
 #define PROX_TRIG_PIN 12
 #define PROX_ECHO_PIN 14
 #define PIR_PIN       27
+#define BATT_PIN      35  // VBAT through a 1:1 divider, as on most ESP32 LiPo boards; nothing there = no batt channel
+#define BOOT_BUTTON_PIN 0
 DHT dht(DHTPIN, DHTTYPE);
 
-/* Gas calibration + mapping */
-const float PPM_MIN = 0.1f;
-const float PPM_MAX = 100000.f;
+/* Gas sampling
+   Gas values (gasRawLast/Min/Max) are eFuse-calibrated millivolts, not raw ADC codes, so a
+   span captured on one board means the same on another. Mapping constants: lunchbox_logic.h */
 const int   MIN_SAMPLES = 120;
-const int   STABLE_CYCLES_MAX = 25;
 const int   SAMPLE_BLOCK = 8;
 const int   SAMPLE_DELAY_MS = 4;
+const float GAS_FULL_SCALE_MV = 3300.0f;
+
+/* Gas ADC: continuous (DMA) conversion on core 3.x -- the driver averages GAS_DMA_FRAME
+   conversions per frame at a fixed rate and applies the calibration; the CPU only picks up
+   finished frames. Older cores and the power-managed modes (DMA keeps the APB clock up)
+   fall back to one-shot analogReadMilliVolts(). */
+#if defined(ESP_ARDUINO_VERSION_MAJOR) && ESP_ARDUINO_VERSION_MAJOR >= 3
+#define GAS_HAVE_DMA 1
+#else
+#define GAS_HAVE_DMA 0
+#endif
+const uint32_t GAS_DMA_FREQ_HZ = 20000;  // lowest rate the ESP32 continuous driver accepts
+const uint32_t GAS_DMA_FRAME   = 64;     // conversions per averaged frame (3.2 ms)
 
 /* Timing */
 const unsigned long DHT_INTERVAL_MS   = 2500;
 const unsigned long GAS_POLL_MS       = 300;
 const unsigned long PRINT_INTERVAL_MS = 5000;
-const unsigned long MIN_POST_INTERVAL = 2000;
-const unsigned long FORCE_INTERVAL    = 25000;
-
-/* Thresholds */
-const float TEMP_DELTA_MIN       = 0.2f;
-const float HUMI_DELTA_MIN       = 1.0f;
-const float GAS_RATIO_DELTA_MIN  = 0.10f;   // fraction of span
-const float GAS_PPM_DELTA_MIN    = 500.0f;  // absolute ppm change
-const float PROX_DELTA_MIN       = 2.0f;    // cm change to trigger send
-/* Smoothing / clamping */
-const float GAS_PPM_EMA_ALPHA    = 0.30f;
-const float PPM_DISPLAY_MIN      = 1.0f;
-const float PPM_DISPLAY_MAX      = 5000.0f; // compress extremes
-
-/* DHT outlier guard */
-const float TEMP_SPIKE_MAX_DIFF  = 15.0f;
-const float HUMI_SPIKE_MAX_DIFF  = 20.0f;
-
-/* State */
+const unsigned long GAS_BLOCK_MS      = 100;   // one SAMPLE_BLOCK average per 100 ms (old loop cadence)
+const unsigned long PROX_INTERVAL_MS  = 100;
+const uint32_t PROX_ECHO_MIN_US       = 116;    // 2 cm, sensor minimum
+const uint32_t PROX_ECHO_TIMEOUT_US   = 20000;  // ~340 cm; no echo by then = no target
+const unsigned long PIR_INTERVAL_MS   = 50;
+const unsigned long DECIDE_INTERVAL_MS= 50;
+const unsigned long UPLINK_POLL_MS    = 100;
+const unsigned long SERVICE_INTERVAL_MS = 50;
+const unsigned long WIFI_RETRY_MS     = 15000;
+const unsigned long UPLINK_BACKOFF_MIN_MS = 600;
+const unsigned long UPLINK_BACKOFF_MAX_MS = 30000;
+const unsigned long LP_POLL_MS        = 500;    // gas/prox/pir/decide cadence in light/deep modes
+const unsigned long LIGHT_SLEEP_MIN_MS= 20;     // shorter idle stretches aren't worth a sleep/wake
+const uint32_t      DEEP_SLEEP_S      = 60;
+const uint16_t      DEEP_BATCH_RECORDS= 20;     // deep mode: only bring Wi-Fi up once this many are queued
+const unsigned long DEEP_WIFI_TIMEOUT_MS = 8000;
+const unsigned long FAST_WIFI_TIMEOUT_MS = 4000;  // cached BSSID/IP not up by then: forget the cache
+const unsigned long SNTP_HOLD_MS      = 10000;  // hold back unsynced readings this long after Wi-Fi is up
+const unsigned long BOOT_HOLD_MS      = 3000;   // BOOT long-press = 'R'
+const unsigned long DIAG_INTERVAL_MS  = 300000; // perf counters -> 'diag' readings, then reset
+
+/* Buffering / batched upload */
+const uint16_t RING_CAPACITY      = 96;    // readings held while offline (~19 full snapshots)
+const uint16_t BATCH_MAX_RECORDS  = 32;    // readings per POST (buffer sizing; the config may lower it)
+const uint16_t READING_QUEUE_LEN  = 32;    // sampling core -> uplink core hand-off
+
+/* Runtime config
+   The constants above, plus the per-channel send policy, smoothing and DHT outlier guard in
+   lunchbox_logic.h, are defaults. The server can retune periods, channel policy, batching and
+   alert limits through the ingest reply ('cfg', monitoring/device_config.py); an accepted
+   config is cached in NVS ("devcfg") and kept in RTC memory across deep sleep. */
+const uint16_t DEVCFG_WIRE_VERSION = 1;  // 'cfg' schema (server DEVICE_CONFIG_VERSION)
+const uint16_t DEVCFG_VERSION      = 2;  // NVS layout; bump whenever DeviceConfig's layout changes
+
+struct AlertLimits { float tempHigh, tempLow, humiHigh, humiLow, gasHigh, proxNear, battLow; };
+
+struct DeviceConfig {
+  char          etag[16];  // "" = firmware defaults
+  unsigned long dhtMs, proxMs, pirMs;
+  SendPolicy    send;
+  BatchPolicy   batch;
+  uint16_t      batchMax;
+  AlertLimits   alerts;    // crossing one skips compression and batching
+};
+
+RTC_DATA_ATTR DeviceConfig devCfg = { "", DHT_INTERVAL_MS, PROX_INTERVAL_MS, PIR_INTERVAL_MS, SendPolicy(),
+                                      BatchPolicy(), BATCH_MAX_RECORDS,
+                                      { 30.0f, 4.0f, 75.0f, 20.0f, 200.0f, 10.0f, 20.0f } };
+DeviceConfig  devCfgIncoming;          // parsed on the uplink core...
+volatile bool devCfgPending = false;   // ...applied by taskService on the sampling core
+
+/* Dual-core pipeline: sampling pinned to core 1, networking to core 0 (where the Wi-Fi stack runs) */
+const BaseType_t SAMPLING_CORE    = 1;
+const BaseType_t UPLINK_CORE      = 0;
+const uint32_t   SAMPLING_STACK   = 4096;
+const uint32_t   UPLINK_STACK     = 10240;  // TLS handshake needs the headroom
+
+/* State
+   RTC_DATA_ATTR = RTC slow memory: reset on power-up, kept across deep sleep, so a wake
+   resumes change detection, smoothing and calibration without touching NVS. */
 float dhtTemp = NAN, dhtHumi = NAN;
-float lastGoodTemp = NAN, lastGoodHumi = NAN;
-float lastSentTemp = NAN, lastSentHumi = NAN, lastSentGasPPM = NAN;
-float lastSentProx = NAN;
-int   lastSentMotion = -1;
-float gasRawMin = NAN, gasRawMax = NAN;
-bool  gasMaxLocked = false;
+RTC_DATA_ATTR float lastGoodTemp = NAN, lastGoodHumi = NAN;
+RTC_DATA_ATTR SendState sendState;  // per-channel compressor state; times are pwrClockMs() in deep mode
+RTC_DATA_ATTR float gasRawMin = NAN, gasRawMax = NAN;
+RTC_DATA_ATTR bool  gasMaxLocked = false;
 int   gasStableCount = 0;
-bool  usedStoredCalibration = false;
-bool  gasMetaSent = false;
-float gasPpmEma = NAN;
+RTC_DATA_ATTR bool  usedStoredCalibration = false;
+RTC_DATA_ATTR bool  gasMetaSent = false;
+RTC_DATA_ATTR float gasMetaRaw = NAN;  // gasRawLast when the first gas point was queued: the meta's "raw"
+RTC_DATA_ATTR float gasPpmEma = NAN;
+
+float proxCm = NAN;            // filtered pings (median + EMA, lunchbox_logic.h)
+SensorFilters sensorFilters;   // per-channel pipelines; each task steps only its own
+int   motionState = 0;
+uint16_t motionRises = 0;            // rising PIR edges since the last snapshot
+volatile bool uplinkUrgent = false;  // motion or an alert crossing is queued: send without batching
 
 unsigned long lastGasPoll = 0;
-unsigned long lastDhtPoll = 0;
 unsigned long lastJson    = 0;
-unsigned long lastPost    = 0;
+unsigned long lastFlush   = 0;
+float gasRawLast = NAN;
+
+/* Reading ring buffer
+   The sampling path appends compact records; the flush stage drains them in batches.
+   Fixed capacity: when full, the oldest record is overwritten and ringDropped counts it. */
+enum SensorId : uint8_t { SID_TEMP=0, SID_HUMI, SID_GAS, SID_PROX, SID_MOTION, SID_DIAG, SID_BATT, SID_COUNT };
+static_assert(CHANNELS[CHN_GAS].sid==SID_GAS && CHANNELS[CHN_MOTION].sid==SID_MOTION &&
+              CHANNELS[CHN_BATT].sid==SID_BATT, "SensorId out of step with CHANNELS");
+// Channel of a sensor id, or CHN_COUNT for 'diag'
+int sidChannel(uint8_t sid){
+  for(int c=0;c<CHN_COUNT;c++) if(CHANNELS[c].sid==sid) return c;
+  return CHN_COUNT;
+}
+const char* sensorType(uint8_t sid){
+  int c = sidChannel(sid);
+  return c<CHN_COUNT ? CHANNELS[c].type : "diag";
+}
+// 'motion' records: the level at a snapshot, a PIR edge at the time it happened, or the
+// rising-edge count since the previous snapshot; edge/count are told apart by their unit
+enum MotionSub : uint8_t { MOTION_LEVEL=0, MOTION_EDGE, MOTION_COUNT };
+const char* const MOTION_UNIT[] = { "", "edge", "count" };
+
+/* Perf counters: one log2 histogram of microseconds per hot-path section */
+enum PerfId : uint8_t { PERF_GAS=0, PERF_DHT, PERF_PROX, PERF_BUILD, PERF_SERIALIZE, PERF_CONNECT, PERF_HTTP,
+                        PERF_JITTER, PERF_COUNT };
+const char* const PERF_NAME[PERF_COUNT] = { "gas", "dht", "prox", "build", "serialize", "connect", "http", "jitter" };
+// 'diag' readings name their metric in the unit field: one p99 per section, then heap
+enum DiagId : uint8_t { DIAG_HEAP_MIN = PERF_COUNT, DIAG_HEAP_BLK, DIAG_COUNT };
+const char* const DIAG_UNIT[DIAG_COUNT] = { "gas_p99", "dht_p99", "prox_p99", "build_p99", "ser_p99", "conn_p99",
+                                            "http_p99", "jit_p99", "heap_min", "heap_blk" };
+const int PERF_BUCKETS = 25;  // bucket k holds [2^k, 2^(k+1)) us; the last one is open-ended (>16 s)
+
+struct PerfStat {
+  uint32_t n, minUs, maxUs;
+  uint64_t sumUs;
+  uint32_t hist[PERF_BUCKETS];
+};
+
+enum ReadingFlags : uint8_t { RF_MONO = 0x01 };  // ts is pwrClockMs()/1000, not epoch (yet)
+
+struct Reading {
+  uint32_t ts;      // epoch seconds, or monotonic seconds while RF_MONO is set
+  uint8_t  sensor;  // SensorId
+  uint8_t  flags;   // ReadingFlags (fits in what was padding)
+  uint8_t  sub;     // DiagId for SID_DIAG, else 0 (also padding)
+  float    value;
+};
+
+// Cached association + DHCP lease, replayed on the next boot to skip the scan and DHCP
+struct NetCache {
+  uint8_t  bssid[6];
+  int32_t  channel;
+  uint32_t ip, gw, mask, dns;
+};
+
+// Owned by the uplink task; the sampling task only ever touches readingQueue.
+// In RTC memory so unsent readings survive deep sleep (96 x 12 B of the 8 KB).
+RTC_DATA_ATTR Reading  ring[RING_CAPACITY];
+RTC_DATA_ATTR uint16_t ringHead = 0, ringCount = 0;
+RTC_DATA_ATTR uint32_t ringDropped = 0;
+
+QueueHandle_t readingQueue = nullptr;
+TaskHandle_t  samplingTaskHandle = nullptr, uplinkTaskHandle = nullptr;
+volatile uint32_t queueDropped = 0;      // queue full: uplink core fell behind
+volatile UBaseType_t queueHighWater = 0; // most readings ever waiting in the queue
+
+// Sized for BATCH_MAX_RECORDS readings plus the one-off gas meta fields
+StaticJsonDocument<4096> doc;
+
+// Fixed request/response buffers: the payload path never touches the heap
+const size_t TX_BUF_SIZE = 3584;
+const size_t RX_BUF_SIZE = 512;
+char txBuf[TX_BUF_SIZE];
+char rxBuf[RX_BUF_SIZE];
+
+/* Perf counters
+   Sections are timed with the CPU cycle counter (tasks are pinned, so start and end read the
+   same core's counter; esp_pm frequency scaling would skew the cycles->us conversion, so
+   read light-mode numbers with that in mind) and kept as log2 histograms: recording costs a clz and two adds, and
+   p99 comes out to within a factor of two. Each section is only ever written by one task.
+   'P' prints them; every DIAG_INTERVAL_MS they are sent as 'diag' readings and reset. */
+PerfStat perf[PERF_COUNT];
+uint32_t cpuMHz = 240;
+
+inline uint32_t perfBegin(){ return ESP.getCycleCount(); }
+
+void perfAddUs(uint8_t id, uint32_t us){
+  PerfStat& p = perf[id];
+  int b = us ? 31 - __builtin_clz(us) : 0;
+  if(b >= PERF_BUCKETS) b = PERF_BUCKETS-1;
+  p.hist[b]++;
+  if(!p.n || us < p.minUs) p.minUs = us;
+  if(us > p.maxUs) p.maxUs = us;
+  p.sumUs += us;
+  p.n++;
+}
+
+void perfEnd(uint8_t id, uint32_t startCycles){ perfAddUs(id, (ESP.getCycleCount()-startCycles)/cpuMHz); }
+
+// Upper edge of the bucket holding the q-quantile, capped at the observed max
+uint32_t perfQuantileUs(const PerfStat& p, float q){
+  if(!p.n) return 0;
+  uint32_t want = (uint32_t)ceilf(q*p.n), acc = 0;
+  for(int b=0;b<PERF_BUCKETS;b++){
+    acc += p.hist[b];
+    if(acc >= want){
+      uint32_t edge = b+1 < 32 ? (1UL<<(b+1)) - 1 : p.maxUs;
+      return edge < p.maxUs ? edge : p.maxUs;
+    }
+  }
+  return p.maxUs;
+}
+
+void perfReset(){ memset(perf, 0, sizeof(perf)); }
+
+void printPerfStats(){
+  Serial.println("[PERF] section       n     min(us)     avg(us)     p99(us)     max(us)");
+  for(int i=0;i<PERF_COUNT;i++){
+    const PerfStat& p = perf[i];
+    if(!p.n) continue;
+    Serial.printf("[PERF] %-9s %7lu %11lu %11lu %11lu %11lu\n", PERF_NAME[i], (unsigned long)p.n,
+                  (unsigned long)p.minUs, (unsigned long)(p.sumUs/p.n), (unsigned long)perfQuantileUs(p, 0.99f),
+                  (unsigned long)p.maxUs);
+  }
+  Serial.printf("[PERF] heap free=%u min=%u maxblk=%u\n",
+                (unsigned)ESP.getFreeHeap(), (unsigned)ESP.getMinFreeHeap(), (unsigned)ESP.getMaxAllocHeap());
+}
 
-// Bump JSON buffer to ensure all readings (incl. prox & motion) fit even when gas meta fields are present
-// Previously 768 was marginal and could drop the last-added objects under memory pressure.
-StaticJsonDocument<1536> doc;
+/* ppm lookup table
+   ppm depends only on where raw sits in the locked span, so the log-scale curve (display
+   clamp included) is tabulated once per calibration and the hot path interpolates. Not in
+   RTC memory: rebuilding it after a deep-sleep wake costs less than the space. */
+float gasPpmLut[GAS_LUT_STEPS+1];
+float gasInvSpan = 0;
+bool  gasLutReady = false;
+
+void gasLutBuild(){
+  gasLutReady = false;
+  if(!gasMaxLocked || gasRawMax <= gasRawMin+1) return;
+  gasInvSpan = 1.0f/(gasRawMax-gasRawMin);
+  gasLutFill(gasPpmLut);
+  gasLutReady = true;
+}
 
 /* Persistence */
 Preferences prefs;
 const char* NVS_NAMESPACE = "gascal";
-const uint16_t CAL_VERSION = 1;
+const uint16_t CAL_VERSION = 2;  // 2: span in calibrated mV (v1 stored raw ADC codes)
 
 uint32_t simpleChecksum(float a, float b) {
   uint32_t* pa = (uint32_t*)&a;
@@ -121,13 +351,14 @@ bool loadCalibration() {
     return false;
   }
   // If max is missing or span invalid, treat as incomplete (user must finish the MAX lock step)
-  if(!(sMin>=0 && sMax<=4095 && sMax>sMin+29)){
+  if(!(sMin>=0 && sMax<=GAS_FULL_SCALE_MV && sMax>sMin+GAS_SPAN_MIN_MV)){
     Serial.println("[CAL] Stored calibration incomplete/invalid; recalibrate");
     return false;
   }
   // Verify checksum on valid span only
   if(crc != simpleChecksum(sMin,sMax)){ Serial.println("[CAL] CRC mismatch; recalibrating"); return false; }
   gasRawMin = sMin; gasRawMax = sMax; gasMaxLocked = true; usedStoredCalibration = true;
+  gasLutBuild();
   Serial.printf("[CAL] Loaded min=%.1f max=%.1f\n", gasRawMin, gasRawMax);
   return true;
 }
@@ -148,7 +379,10 @@ void saveCalibration() {
    - 'E' : software reset (ESP.restart) -> preserves NVS, like EN button
    - 'X' : clear calibration namespace, then restart
    - 'R' : force recalibration on next boot (clears cal + restart)
+   - 'T' : scheduler task stats (runs / deadline misses / worst latency) + queue/stack high-water
+   - 'P' : hot-path perf counters (min/avg/p99/max per section since the last diag report) + heap
 */
+void printSchedStats();
 void printStoredCal(){
   if(!prefs.begin(NVS_NAMESPACE, true)){
     Serial.println("[CAL] NVS open fail (RO) while printing");
@@ -168,6 +402,10 @@ void handleSerialCommands(){
     if(c=='\n' || c=='\r') continue;
     if(c=='S' || c=='s'){
       printStoredCal();
+    } else if(c=='T' || c=='t'){
+      printSchedStats();
+    } else if(c=='P' || c=='p'){
+      printPerfStats();
     } else if(c=='E' || c=='e'){
       Serial.println("[CAL] SW reset via esp_restart()");
       delay(100);
@@ -181,31 +419,161 @@ void handleSerialCommands(){
   delay(100);
   esp_restart();
     } else {
-      Serial.printf("[CMD] Unknown '%c' (use S=show, E=reset, X=clear+reset, R=recal+reset)\n", c);
+      Serial.printf("[CMD] Unknown '%c' (use S=show, T=tasks, P=perf, E=reset, X=clear+reset, R=recal+reset)\n", c);
     }
   }
 }
 
-/* Time */
-bool timeSynced=false;
-String isoTimestampUTC(){
-  if(!timeSynced) return String();
-  time_t now=time(nullptr); if(now<1700000000) return String();
-  struct tm* t=gmtime(&now); char buf[25];
-  strftime(buf,sizeof(buf),"%Y-%m-%dT%H:%M:%SZ",t);
-  return String(buf);
+/* Time (the RTC keeps counting through deep sleep, so a synced clock stays synced) */
+RTC_DATA_ATTR bool timeSynced=false;
+// Monotonic device clock: millis() plus all earlier wakes and deep sleeps
+RTC_DATA_ATTR uint64_t pwrClockBaseMs = 0;
+unsigned long pwrClockMs(){ return (unsigned long)(pwrClockBaseMs + millis()); }
+int64_t rtcNowMs(){ struct timeval tv; gettimeofday(&tv, nullptr); return (int64_t)tv.tv_sec*1000 + tv.tv_usec/1000; }
+
+// SNTP runs in the lwIP task once started; this only notices that it has landed
+bool clockSynced(){
+  if(!timeSynced && time(nullptr)>1700000000) timeSynced=true;
+  return timeSynced;
 }
+
+void sntpStart(){ configTime(0,0,"pool.ntp.org","time.nist.gov"); }
+
 void syncTime(){
-  configTime(0,0,"pool.ntp.org","time.nist.gov");
+  sntpStart();
   Serial.print("Time sync");
-  for(int i=0;i<40;i++){ time_t now=time(nullptr); if(now>1700000000){ timeSynced=true; Serial.println(" OK"); return; } Serial.print('.'); delay(300); }
+  for(int i=0;i<40;i++){ if(clockSynced()){ Serial.println(" OK"); return; } Serial.print('.'); delay(300); }
   Serial.println(" fail");
 }
 
+/* Wi-Fi cache (own Preferences object: the calibration one is used from the sampling core) */
+const char* NET_NAMESPACE = "netcache";
+Preferences netPrefs;
+NetCache netCache;
+bool netCacheValid = false;
+bool wifiFastTry = false;  // an attempt with the cached params is in progress (cleared once up)
+
+void netCacheLoad(){
+  netCacheValid = false;
+  if(!netPrefs.begin(NET_NAMESPACE, true)) return;
+  netCacheValid = netPrefs.getBytes("net", &netCache, sizeof(netCache))==sizeof(netCache) && netCache.ip;
+  netPrefs.end();
+}
+
+void netCacheSave(){
+  NetCache c = {};
+  const uint8_t* b = WiFi.BSSID();
+  if(b) memcpy(c.bssid, b, sizeof(c.bssid));
+  c.channel = WiFi.channel();
+  c.ip = (uint32_t)WiFi.localIP(); c.gw = (uint32_t)WiFi.gatewayIP();
+  c.mask = (uint32_t)WiFi.subnetMask(); c.dns = (uint32_t)WiFi.dnsIP();
+  if(netCacheValid && memcmp(&c, &netCache, sizeof(c))==0) return;  // spare the flash
+  if(!netPrefs.begin(NET_NAMESPACE, false)) return;
+  netPrefs.putBytes("net", &c, sizeof(c));
+  netPrefs.end();
+  netCache = c; netCacheValid = true;
+  Serial.printf("[NET] Cached BSSID/channel %ld/static IP for fast reconnect\n", (long)c.channel);
+}
+
+void netCacheForget(){
+  if(netPrefs.begin(NET_NAMESPACE, false)){ netPrefs.clear(); netPrefs.end(); }
+  netCacheValid = false;
+}
+
+/* Server config cache (sampling core only) */
+const char* CFG_NAMESPACE = "devcfg";
+Preferences cfgPrefs;
+
+uint32_t devCfgChecksum(const DeviceConfig& c){
+  const uint8_t* b = (const uint8_t*)&c;
+  uint32_t h = 2166136261u;  // FNV-1a
+  for(size_t i=0;i<sizeof(c);i++){ h ^= b[i]; h *= 16777619u; }
+  return h;
+}
+
+void devCfgLoad(){
+  if(!cfgPrefs.begin(CFG_NAMESPACE, true)) return;  // nothing stored yet
+  DeviceConfig c;
+  // A blob from another layout is dropped before anything is copied out of it
+  bool ok = cfgPrefs.getUShort("ver",0)==DEVCFG_VERSION && cfgPrefs.getBytesLength("cfg")==sizeof(c) &&
+            cfgPrefs.getBytes("cfg", &c, sizeof(c))==sizeof(c) && cfgPrefs.getUInt("crc",0)==devCfgChecksum(c);
+  cfgPrefs.end();
+  if(ok){ devCfg = c; Serial.printf("[CFG] Loaded server config %s\n", devCfg.etag); }
+}
+
+void devCfgSave(){
+  if(!cfgPrefs.begin(CFG_NAMESPACE, false)){ Serial.println("[CFG] NVS RW open fail"); return; }
+  cfgPrefs.putUShort("ver", DEVCFG_VERSION);
+  cfgPrefs.putBytes("cfg", &devCfg, sizeof(devCfg));
+  cfgPrefs.putUInt("crc", devCfgChecksum(devCfg));
+  cfgPrefs.end();
+}
+
+// Start an association without waiting for it
+void wifiBegin(){
+  WiFi.mode(WIFI_STA);
+  wifiFastTry = FAST_BOOT && netCacheValid;
+  if(wifiFastTry){
+    WiFi.config(IPAddress(netCache.ip), IPAddress(netCache.gw), IPAddress(netCache.mask), IPAddress(netCache.dns));
+    WiFi.begin(WIFI_SSID, WIFI_PASS, netCache.channel, netCache.bssid);
+  } else {
+    WiFi.begin(WIFI_SSID, WIFI_PASS);
+  }
+}
+
+// The cached AP/lease went stale: drop it and redo scan + DHCP
+void wifiFallbackFromCache(){
+  Serial.println("[NET] Cached Wi-Fi params failed; full scan + DHCP");
+  netCacheForget();
+  WiFi.disconnect();
+  WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0), IPAddress((uint32_t)0));
+  wifiBegin();
+}
+
 /* Helpers */
+bool gasDma = false;
+volatile uint32_t gasDmaFrames = 0;
+void ARDUINO_ISR_ATTR gasDmaFrameDone(){ gasDmaFrames++; }
+
+// The continuous driver owns ADC1 while it runs, so the battery pin is converted in the
+// same frames (half the rate each) instead of by one-shot reads
+float battMvDma = NAN;
+
+void gasAdcBegin(){
+  analogSetPinAttenuation(GAS_PIN, ADC_11db);
+  analogSetPinAttenuation(BATT_PIN, ADC_11db);
+#if GAS_HAVE_DMA
+  if(POWER_MODE!=POWER_ACTIVE) return;
+  static const uint8_t pins[] = { GAS_PIN, BATT_PIN };
+  analogContinuousSetAtten(ADC_11db);
+  analogContinuousSetWidth(12);
+  gasDma = analogContinuous(pins, 2, GAS_DMA_FRAME, GAS_DMA_FREQ_HZ, &gasDmaFrameDone) && analogContinuousStart();
+  Serial.printf("[ADC] gas %s\n", gasDma ? "continuous DMA" : "DMA init failed; one-shot reads");
+#endif
+}
+
+// Mean of the frames finished since the last call; false = none yet
+bool gasDmaTake(float& mv){
+#if GAS_HAVE_DMA
+  adc_continuous_data_t* res = nullptr;
+  long sum=0; int n=0;
+  while(n<8 && analogContinuousRead(&res, 0)){ sum += res[0].avg_read_mvolts; battMvDma = res[1].avg_read_mvolts; n++; }
+  if(!n) return false;
+  mv = (float)sum/n;
+  return true;
+#else
+  return false;
+#endif
+}
+
 float readGasBlockAvg(){
+  if(gasDma){
+    float mv; unsigned long t0=millis();
+    while(!gasDmaTake(mv)){ if(millis()-t0>20) return gasRawLast; delay(1); }
+    return mv;
+  }
   long sum=0;
-  for(int i=0;i<SAMPLE_BLOCK;i++){ sum+=analogRead(GAS_PIN); delay(SAMPLE_DELAY_MS); }
+  for(int i=0;i<SAMPLE_BLOCK;i++){ sum+=analogReadMilliVolts(GAS_PIN); delay(SAMPLE_DELAY_MS); }
   return (float)sum/SAMPLE_BLOCK;
 }
 
@@ -213,295 +581,1140 @@ void captureGasMin(){
   float acc=0;
   for(int i=0;i<MIN_SAMPLES;i++) acc+=readGasBlockAvg();
   gasRawMin = acc/MIN_SAMPLES;
-  Serial.printf("Gas MIN captured rawMin=%.1f\n", gasRawMin);
+  Serial.printf("Gas MIN captured rawMin=%.1fmV\n", gasRawMin);
   Serial.println("Move slider HIGH until 'Gas MAX locked'.");
 }
 
 void considerLockMax(float raw){
   if(gasMaxLocked) return;
-  if(isnan(gasRawMax) || raw>gasRawMax){ gasRawMax=raw; gasStableCount=0; }
-  else gasStableCount++;
-  if(!isnan(gasRawMax) && gasStableCount>=STABLE_CYCLES_MAX){
-    if(gasRawMax - gasRawMin < 30){ Serial.println("[WARN] Span too small; raise slider."); gasStableCount=0; return; }
+  CalEvent ev = gasMaxStep(raw, gasRawMin, gasRawMax, gasStableCount);
+  if(ev==CAL_SPAN_LOW){ Serial.println("[WARN] Span too small; raise slider."); return; }
+  if(ev==CAL_LOCKED){
     gasMaxLocked=true;
-    Serial.printf("Gas MAX locked rawMax=%.1f span=%.1f\n",gasRawMax, gasRawMax-gasRawMin);
+    gasLutBuild();
+    Serial.printf("Gas MAX locked rawMax=%.1fmV span=%.1fmV\n",gasRawMax, gasRawMax-gasRawMin);
     saveCalibration();
   }
 }
 
 float linearRatio(float raw){
-  if(!gasMaxLocked || gasRawMax <= gasRawMin+1) return NAN;
-  float r=(raw-gasRawMin)/(gasRawMax-gasRawMin);
-  if(r<0) r=0; if(r>1) r=1;
-  return r;
+  if(!gasLutReady) gasLutBuild();  // first use after a deep-sleep wake
+  if(!gasLutReady) return NAN;
+  return gasRatio(raw, gasRawMin, gasInvSpan);
 }
 
 float mapGasToPPM(float raw){
   if(!gasMaxLocked || isnan(raw)) return NAN;
   float r=linearRatio(raw);
   if(isnan(r)) return NAN;
-  float logMin=log10(PPM_MIN), logMax=log10(PPM_MAX);
-  float ppm = pow(10, logMin + r*(logMax-logMin));
-  if(ppm<PPM_DISPLAY_MIN) ppm=PPM_DISPLAY_MIN;
-  if(ppm>PPM_DISPLAY_MAX) ppm=PPM_DISPLAY_MAX;
-  return ppm;
+  return gasLutPpm(gasPpmLut, r);
 }
 
-void connectWiFi(){
-  if(WiFi.status()==WL_CONNECTED) return;
-  WiFi.mode(WIFI_STA);
-  WiFi.begin(WIFI_SSID, WIFI_PASS);
+// Blocking bring-up (slow boot path and deep-mode uploads)
+bool connectWiFi(unsigned long timeoutMs){
+  if(WiFi.status()==WL_CONNECTED) return true;
+  wifiBegin();
   Serial.print("WiFi connecting");
   unsigned long start=millis();
-  while(WiFi.status()!=WL_CONNECTED && millis()-start<15000){ Serial.print('.'); delay(500); }
-  if(WiFi.status()==WL_CONNECTED){ Serial.print("\nWiFi IP: "); Serial.println(WiFi.localIP()); }
-  else Serial.println("\nWiFi failed.");
+  while(WiFi.status()!=WL_CONNECTED && millis()-start<timeoutMs){
+    if(wifiFastTry && millis()-start>=FAST_WIFI_TIMEOUT_MS) wifiFallbackFromCache();
+    Serial.print('.'); delay(100);
+  }
+  if(WiFi.status()==WL_CONNECTED){
+    wifiFastTry=false;
+    Serial.print("\nWiFi IP: "); Serial.println(WiFi.localIP()); netCacheSave(); return true;
+  }
+  Serial.println("\nWiFi failed.");
+  return false;
 }
 
 // --- New sensor helpers ---
-float readProximityCm(){
+/* HC-SR04 ranging without pulseIn(): the echo pin interrupts on both edges and the ISR
+   timestamps them, so a ping costs the 10 us trigger pulse and the echo width arrives in
+   proxEchoUs while the sampling task does other work. */
+volatile int64_t  proxRiseUs  = 0;
+volatile uint32_t proxEchoUs  = 0;
+volatile uint32_t proxEchoSeq = 0;  // bumped after proxEchoUs is written
+uint32_t proxSeqSeen = 0;
+bool     proxPending = false;       // a ping is out and its result not yet collected
+
+void ARDUINO_ISR_ATTR proxEchoIsr(){
+  int64_t t = esp_timer_get_time();
+  if(digitalRead(PROX_ECHO_PIN)) proxRiseUs = t;
+  else if(proxRiseUs){ proxEchoUs = (uint32_t)(t - proxRiseUs); proxRiseUs = 0; proxEchoSeq++; }
+}
+
+void proxBegin(){
   pinMode(PROX_TRIG_PIN, OUTPUT);
-  pinMode(PROX_ECHO_PIN, INPUT);
   digitalWrite(PROX_TRIG_PIN, LOW);
-  delayMicroseconds(2);
+  pinMode(PROX_ECHO_PIN, INPUT);
+  attachInterrupt(digitalPinToInterrupt(PROX_ECHO_PIN), proxEchoIsr, CHANGE);
+}
+
+void proxTrigger(){
+  proxRiseUs = 0;
+  proxSeqSeen = proxEchoSeq;
   digitalWrite(PROX_TRIG_PIN, HIGH);
   delayMicroseconds(10);
   digitalWrite(PROX_TRIG_PIN, LOW);
-  unsigned long dur = pulseIn(PROX_ECHO_PIN, HIGH, 20000UL);
-  if(dur==0){
+  proxPending = true;
+}
+
+// Result of the outstanding ping. Called a full period after the trigger, by which point the
+// sensor has either echoed or given up, so a missing echo means no target.
+float proxCollect(){
+  proxPending = false;
+  uint32_t us = proxEchoSeq!=proxSeqSeen ? proxEchoUs : 0;
+  if(!us || us > PROX_ECHO_TIMEOUT_US){
     // synthetic oscillation for simulation
     return 14.0f + 6.0f * sin(millis()/3000.0f);
   }
-  return (float)dur * 0.0343f / 2.0f;
+  if(us < PROX_ECHO_MIN_US) us = PROX_ECHO_MIN_US;
+  return (float)us * 0.0343f / 2.0f;
+}
+
+// Ping and wait (yielding) for the echo: for light/deep modes, where the CPU may sleep
+// through an echo left pending across periods
+float proxRangeOnce(){
+  proxTrigger();
+  unsigned long t0 = millis();
+  while(proxEchoSeq==proxSeqSeen && millis()-t0 < PROX_ECHO_TIMEOUT_US/1000 + 2) delay(1);
+  return proxCollect();
 }
 
 int readMotion(){
+  return digitalRead(PIR_PIN) ? 1 : 0;
+}
+
+/* PIR edges are captured by a CHANGE interrupt into a single-producer/single-consumer ring:
+   the ISR only advances pirHead, taskPir only advances pirTail, and both run on the sampling
+   core. A pulse shorter than the poll period, or one that lands while a DHT read blocks, is
+   still seen, with the time it actually happened. */
+const uint8_t PIR_EDGE_CAP = 16;  // power of two
+struct PirEdge { int64_t us; uint8_t level; };
+PirEdge pirEdges[PIR_EDGE_CAP];
+volatile uint8_t  pirHead = 0, pirTail = 0;
+volatile uint32_t pirEdgesLost = 0;
+
+void ARDUINO_ISR_ATTR pirIsr(){
+  uint8_t h = pirHead;
+  if((uint8_t)(h - pirTail) >= PIR_EDGE_CAP){ pirEdgesLost++; return; }
+  PirEdge& e = pirEdges[h & (PIR_EDGE_CAP-1)];
+  e.us = esp_timer_get_time();
+  e.level = digitalRead(PIR_PIN) ? 1 : 0;
+  pirHead = h + 1;
+}
+
+void pirBegin(){
   pinMode(PIR_PIN, INPUT);
-  int v = digitalRead(PIR_PIN);
-  if(v!=HIGH && v!=LOW){
-    static unsigned long last=0; static bool state=false;
-    if(millis()-last>7000){ last=millis(); state=!state; }
-    return state?1:0;
+  motionState = readMotion();
+  attachInterrupt(digitalPinToInterrupt(PIR_PIN), pirIsr, CHANGE);
+}
+
+/* Ring buffer helpers (uplink task only) */
+RTC_DATA_ATTR bool ringHasMono = false;
+
+// Monotonic stamp -> epoch, using the offset between the two clocks right now
+void stampEpoch(Reading& r){
+  uint32_t epochAtZero = (uint32_t)time(nullptr) - pwrClockMs()/1000;
+  r.ts += epochAtZero;
+  r.flags &= ~RF_MONO;
+}
+
+void ringPush(const Reading& r){
+  if(ringCount==RING_CAPACITY){ ringHead=(ringHead+1)%RING_CAPACITY; ringCount--; ringDropped++; }
+  Reading& slot = ring[(ringHead+ringCount)%RING_CAPACITY];
+  slot = r;
+  if(slot.flags & RF_MONO){
+    if(clockSynced()) stampEpoch(slot); else ringHasMono = true;
+  }
+  ringCount++;
+}
+
+// Once SNTP lands, rewrite every reading taken before it with its real time
+void ringFixupTimes(){
+  if(!ringHasMono || !clockSynced()) return;
+  uint16_t fixed=0;
+  for(uint16_t i=0;i<ringCount;i++){
+    Reading& r = ring[(ringHead+i)%RING_CAPACITY];
+    if(r.flags & RF_MONO){ stampEpoch(r); fixed++; }
   }
-  return v?1:0;
+  ringHasMono = false;
+  if(fixed) Serial.printf("[TIME] Synced; re-stamped %u buffered readings\n", fixed);
+}
+
+// Epoch seconds to send, 0 = let the server stamp it (clock never synced)
+uint32_t readingEpoch(const Reading& r){ return (r.flags & RF_MONO) ? 0 : r.ts; }
+const Reading& ringAt(uint16_t i){ return ring[(ringHead+i)%RING_CAPACITY]; }
+void ringPop(uint16_t n){
+  if(n>ringCount) n=ringCount;
+  ringHead=(ringHead+n)%RING_CAPACITY; ringCount-=n;
+}
+
+const char* readingUnit(const Reading& r){
+  if(r.sensor==SID_DIAG) return DIAG_UNIT[r.sub];
+  if(r.sensor==SID_MOTION) return MOTION_UNIT[r.sub];
+  return CHANNELS[sidChannel(r.sensor)].unit;
+}
+
+// Sampling side: stamp a reading taken at atMs (pwrClockMs() clock) and hand it to the
+// uplink core without blocking
+void emitRecordAt(uint8_t sensor, uint8_t sub, float value, unsigned long atMs){
+  Reading r;
+  if(clockSynced()){ r.ts = (uint32_t)time(nullptr) - (pwrClockMs()-atMs)/1000; r.flags = 0; }
+  else             { r.ts = atMs/1000;                                           r.flags = RF_MONO; }
+  r.sensor = sensor; r.sub = sub; r.value = value;
+  if(xQueueSend(readingQueue, &r, 0)!=pdTRUE){ queueDropped++; return; }
+  UBaseType_t waiting = uxQueueMessagesWaiting(readingQueue);
+  if(waiting > queueHighWater) queueHighWater = waiting;
+}
+
+void emitRecord(uint8_t sensor, uint8_t sub, float value){ emitRecordAt(sensor, sub, value, pwrClockMs()); }
+void emitReading(uint8_t sensor, float value){ emitRecord(sensor, 0, value); }
+
+// Perf window -> one 'diag' reading per active section (p99, us) plus heap low-water marks
+void emitDiagnostics(){
+  for(int i=0;i<PERF_COUNT;i++) if(perf[i].n) emitRecord(SID_DIAG, i, (float)perfQuantileUs(perf[i], 0.99f));
+  emitRecord(SID_DIAG, DIAG_HEAP_MIN, (float)ESP.getMinFreeHeap());
+  emitRecord(SID_DIAG, DIAG_HEAP_BLK, (float)ESP.getMaxAllocHeap());
+  perfReset();
 }
 
-String buildPayload(float t,float h,float gasPpm,float gasRaw){
+// Serialize up to maxRecords queued readings into txBuf as JSON
+size_t buildBatchJson(uint16_t maxRecords, uint16_t& used, bool& carriesGasMeta){
   doc.clear();
   doc["api_key"]=DEVICE_API_KEY;
+  if(USE_MQTT && devCfg.etag[0]) doc["e"]=(const char*)devCfg.etag;
   JsonArray readings = doc.createNestedArray("readings");
-  auto add=[&](const char* type,float v,const char* unit){
-    if(isnan(v)) return;
+  used=0; carriesGasMeta=false;
+  char tsBuf[25]; uint32_t tsFor=0;  // a snapshot's readings share one stamp: format it once
+  uint16_t n = ringCount<maxRecords ? ringCount : maxRecords;
+  for(uint16_t i=0;i<n;i++){
+    if(doc.capacity()-doc.memoryUsage() < 160) break;  // leave room rather than truncate mid-record
+    const Reading& r = ringAt(i);
     JsonObject o = readings.createNestedObject();
-    o["sensor_type"]=type; o["value"]=v; o["unit"]=unit;
-    String ts=isoTimestampUTC(); if(ts.length()) o["recorded_at"]=ts;
-  };
-  if(!isnan(t) && t>-40 && t<125) add("temp",t,"C");
-  if(!isnan(h) && h>=0 && h<=100) add("humi",h,"%");
-  if(gasMaxLocked && !isnan(gasPpm)){
-    JsonObject g=readings.createNestedObject();
-    g["sensor_type"]="gas";
-    g["value"]=gasPpm;
-    g["unit"]="ppm";
-    g["raw"]=gasRaw;
-    if(!gasMetaSent){
+    o["sensor_type"]=sensorType(r.sensor);
+    if(r.sensor==SID_MOTION) o["value"]=(int)r.value; else o["value"]=r.value;
+    o["unit"]= readingUnit(r);
+    if(r.sensor==SID_GAS && !gasMetaSent && !carriesGasMeta){
+      o["raw"]=gasMetaRaw;
+      o["min"]=gasRawMin;
+      o["max"]=gasRawMax;
+      o["cal_src"]=usedStoredCalibration?"stored":"fresh";
+      carriesGasMeta=true;
+    }
+    uint32_t epoch = readingEpoch(r);
+    if(epoch){
+      if(epoch!=tsFor){
+        time_t ts=(time_t)epoch; struct tm tm; gmtime_r(&ts,&tm);
+        strftime(tsBuf,sizeof(tsBuf),"%Y-%m-%dT%H:%M:%SZ",&tm);
+        tsFor=epoch;
+      }
+      o["recorded_at"]=(char*)tsBuf;  // char* -> copied into the document pool, not the heap
+    }
+    used++;
+  }
+  if (doc.overflowed()) {
+    Serial.println(F("[WARN] ArduinoJson buffer overflow while building payload; some readings may be missing"));
+  }
+  if(measureJson(doc) >= TX_BUF_SIZE){
+    Serial.println(F("[WARN] Payload exceeds TX_BUF_SIZE; not sending"));
+    used=0; return 0;
+  }
+  uint32_t c0 = perfBegin();
+  size_t len = serializeJson(doc, txBuf, TX_BUF_SIZE);
+  perfEnd(PERF_SERIALIZE, c0);
+  return len;
+}
+
+// Same batch as MessagePack: {v:1, t0:<base epoch>, r:[[sid, dt|nil, value],...], g:{gas meta}}
+// A record is ~12 bytes instead of ~90, and the server reads it without any date parsing.
+size_t buildBatchMsgPack(uint16_t maxRecords, uint16_t& used, bool& carriesGasMeta){
+  doc.clear();
+  used=0; carriesGasMeta=false;
+  uint16_t n = ringCount<maxRecords ? ringCount : maxRecords;
+  uint32_t t0=0;
+  for(uint16_t i=0;i<n;i++){ uint32_t ts=readingEpoch(ringAt(i)); if(ts && (!t0 || ts<t0)) t0=ts; }
+  doc["v"]=1;
+  doc["t0"]=t0;
+  if(USE_MQTT){  // no headers over MQTT: key and config ETag ride in the body
+    doc["k"]=DEVICE_API_KEY;
+    if(devCfg.etag[0]) doc["e"]=(const char*)devCfg.etag;
+  }
+  JsonArray rows = doc.createNestedArray("r");
+  for(uint16_t i=0;i<n;i++){
+    if(doc.capacity()-doc.memoryUsage() < 160) break;
+    const Reading& r = ringAt(i);
+    JsonArray row = rows.createNestedArray();
+    row.add(r.sensor);
+    uint32_t epoch = readingEpoch(r);
+    if(epoch) row.add(epoch-t0); else row.add(nullptr);  // nil: server stamps it on arrival
+    if(r.sensor==SID_MOTION) row.add((int)r.value); else row.add(r.value);
+    if(r.sensor==SID_DIAG || (r.sensor==SID_MOTION && r.sub)) row.add(readingUnit(r));
+    if(r.sensor==SID_GAS && !gasMetaSent && !carriesGasMeta){
+      JsonObject g = doc.createNestedObject("g");
+      g["raw"]=gasMetaRaw;
       g["min"]=gasRawMin;
       g["max"]=gasRawMax;
-      g["cal_src"]=usedStoredCalibration?"stored":"fresh";
+      g["cal"]=usedStoredCalibration?"stored":"fresh";
+      carriesGasMeta=true;
     }
-    String ts=isoTimestampUTC(); if(ts.length()) g["recorded_at"]=ts;
-  }
-  // New sensors
-  float prox = readProximityCm();
-  if(!isnan(prox)) add("prox", prox, "cm");
-  int motion = readMotion();
-  {
-    JsonObject m = readings.createNestedObject();
-    m["sensor_type"] = "motion";
-    m["value"] = motion;
-    m["unit"] = "";
-    String ts=isoTimestampUTC(); if(ts.length()) m["recorded_at"]=ts;
-  }
-  // Optional debug to detect payload truncation
+    used++;
+  }
   if (doc.overflowed()) {
     Serial.println(F("[WARN] ArduinoJson buffer overflow while building payload; some readings may be missing"));
   }
-  String out; serializeJson(doc,out); return out;
+  if(measureMsgPack(doc) >= TX_BUF_SIZE){
+    Serial.println(F("[WARN] Payload exceeds TX_BUF_SIZE; not sending"));
+    used=0; return 0;
+  }
+  uint32_t c0 = perfBegin();
+  size_t len = serializeMsgPack(doc, txBuf, TX_BUF_SIZE);
+  perfEnd(PERF_SERIALIZE, c0);
+  return len;
+}
+
+// Returns the body length in txBuf (0 = nothing to send)
+size_t buildBatchPayload(uint16_t maxRecords, uint16_t& used, bool& carriesGasMeta){
+  uint32_t c0 = perfBegin();
+  size_t len = USE_MSGPACK ? buildBatchMsgPack(maxRecords, used, carriesGasMeta)
+                           : buildBatchJson(maxRecords, used, carriesGasMeta);
+  perfEnd(PERF_BUILD, c0);
+  return len;
 }
 
-bool postJSON(const String& payload){
+/* Uplink connection
+   One long-lived client per transport, reused across POSTs via HTTP/1.1 keep-alive.
+   The socket (and its TLS session) is only torn down when a request fails at the
+   transport level (code<0) or the peer closes it; the next POST then reconnects.
+   Note: WiFiClientSecure does not expose mbedTLS session tickets/IDs, so a drop
+   still costs a full handshake -- keeping the socket alive is what saves it. */
+WiFiClientSecure tlsClient;
+WiFiClient       lanClient;
+HTTPClient       http;
+uint32_t netConnects = 0, netReuses = 0, netDrops = 0;
+
+WiFiClient& uplinkClient(){ return USE_TUNNEL ? (WiFiClient&)tlsClient : lanClient; }
+
+void uplinkDrop(){
+  http.end();
+  uplinkClient().stop();
+  netDrops++;
+}
+
+// Ensure the socket is up. dnsMs/connMs stay 0 when an open connection is reused.
+bool uplinkConnect(const char* host, uint16_t port, unsigned long& dnsMs, unsigned long& connMs){
+  dnsMs=0; connMs=0;
+  WiFiClient& c = uplinkClient();
+  if(c.connected()){ netReuses++; return true; }
+  c.stop();
+  if(USE_TUNNEL) tlsClient.setInsecure();
+  unsigned long t0=millis();
+  IPAddress ip;
+  if(!WiFi.hostByName(host, ip)){ Serial.printf("[NET] DNS failed for %s\n", host); return false; }
+  dnsMs=millis()-t0;
+  t0=millis();
+  // TLS: lwIP has the name cached now, so this is TCP connect + TLS handshake
+  uint32_t c0 = perfBegin();
+  bool ok = USE_TUNNEL ? tlsClient.connect(host, port) : lanClient.connect(ip, port);
+  perfEnd(PERF_CONNECT, c0);
+  connMs=millis()-t0;
+  if(!ok){ Serial.printf("[NET] Connect failed %s:%u after %lums\n", host, port, connMs); c.stop(); return false; }
+  netConnects++;
+  return true;
+}
+
+// Captures a response body into rxBuf (truncating); writeToStream() handles chunked bodies too,
+// and draining the whole body is what lets the socket be reused.
+struct RxSink : public Stream {
+  size_t len = 0;
+  size_t write(uint8_t c) override { if(len+1<RX_BUF_SIZE){ rxBuf[len++]=(char)c; rxBuf[len]=0; } return 1; }
+  size_t write(const uint8_t* b, size_t n) override { for(size_t i=0;i<n;i++) write(b[i]); return n; }
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+};
+
+// Bounded copy of a config field: out-of-range or missing values keep the current setting
+unsigned long cfgMs(JsonVariant v, unsigned long cur, unsigned long lo, unsigned long hi){
+  float x = v | NAN;
+  return (isnan(x) || x<lo || x>hi) ? cur : (unsigned long)x;
+}
+float cfgFloat(JsonVariant v, float cur, float lo){
+  float x = v | NAN;
+  return (isnan(x) || x<lo) ? cur : x;
+}
+
+// Ingest reply -> devCfgIncoming, when it carries a config (it only does when ours is stale)
+void devCfgFromReply(const char* body){
+  if(devCfgPending || !strstr(body, "\"cfg\"")) return;
+  StaticJsonDocument<1024> doc;
+  if(deserializeJson(doc, body)){ Serial.println("[CFG] Reply not parseable; config ignored"); return; }
+  JsonObject c = doc["cfg"];
+  if((c["v"] | 0)!=DEVCFG_WIRE_VERSION){ Serial.println("[CFG] Unsupported config version; ignored"); return; }
+  JsonArray per = c["p"], ch = c["c"], bat = c["b"], al = c["a"];
+  if(per.size()<3 || ch.size()<CHN_COUNT || bat.size()<3 || al.size()<6){ Serial.println("[CFG] Malformed config; ignored"); return; }
+  // Fields the reply does not carry (each channel's send.ch[].logScale, battLow from an older
+  // server) keep their current value
+  DeviceConfig n = devCfg;
+  strlcpy(n.etag, c["e"] | "", sizeof(n.etag));
+  n.dhtMs  = cfgMs(per[0], n.dhtMs, 2000, 600000);  // DHT22 needs >= 2 s between reads
+  n.proxMs = cfgMs(per[1], n.proxMs, 50, 60000);
+  n.pirMs  = cfgMs(per[2], n.pirMs, 10, 1000);
+  for(int i=0;i<CHN_COUNT;i++){
+    JsonArray f = ch[i];
+    ChannelPolicy& cp = n.send.ch[i];
+    cp.door        = cfgFloat(f[0], cp.door, 0);
+    cp.deadband    = cfgFloat(f[1], cp.deadband, 1e-3f);
+    cp.heartbeatMs = cfgMs(f[2], cp.heartbeatMs, 5000, 3600000);
+    cp.minGapMs    = cfgMs(f[3], cp.minGapMs, 0, 600000);
+  }
+  n.batch.minRecords = (uint16_t)cfgMs(bat[0], n.batch.minRecords, 1, BATCH_MAX_RECORDS);
+  n.batch.flushMs    = cfgMs(bat[1], n.batch.flushMs, 100, 600000);
+  n.batchMax         = (uint16_t)cfgMs(bat[2], n.batchMax, 1, BATCH_MAX_RECORDS);
+  n.alerts.tempHigh = cfgFloat(al[0], n.alerts.tempHigh, -40);
+  n.alerts.tempLow  = cfgFloat(al[1], n.alerts.tempLow, -40);
+  n.alerts.humiHigh = cfgFloat(al[2], n.alerts.humiHigh, 0);
+  n.alerts.humiLow  = cfgFloat(al[3], n.alerts.humiLow, 0);
+  n.alerts.gasHigh  = cfgFloat(al[4], n.alerts.gasHigh, 0);
+  n.alerts.proxNear = cfgFloat(al[5], n.alerts.proxNear, 0);
+  if(al.size()>6) n.alerts.battLow = cfgFloat(al[6], n.alerts.battLow, 0);
+  devCfgIncoming = n;
+  devCfgPending = true;
+}
+
+// Load hints in the ingest reply (monitoring/throttles.py): 'pace' asks for larger batches
+// until a reply comes without it; Retry-After (429/503) sets the next retry
+BatchPolicy uplinkPace;
+bool uplinkPaced = false;
+unsigned long uplinkRetryHintMs = 0;
+const unsigned long RETRY_AFTER_MAX_MS = 600000;
+
+void paceFromReply(const char* body){
+  if(!strstr(body, "\"pace\"")){ uplinkPaced = false; return; }
+  StaticJsonDocument<1024> doc;
+  if(deserializeJson(doc, body)) return;
+  JsonArray p = doc["pace"];
+  if(p.size()<2) return;
+  uplinkPace.minRecords = (uint16_t)cfgMs(p[0], devCfg.batch.minRecords, 1, devCfg.batchMax);
+  uplinkPace.flushMs    = cfgMs(p[1], devCfg.batch.flushMs, 100, 600000);
+  if(!uplinkPaced) Serial.printf("[NET] Server busy: batching %u/%lums\n", (unsigned)uplinkPace.minRecords, uplinkPace.flushMs);
+  uplinkPaced = true;
+}
+
+// One POST attempt; retries and backoff are paced by the uplink task instead of delay()
+bool postPayload(const char* body, size_t len, bool urgent){
   const char* host = USE_TUNNEL?TUNNEL_HOST:LAN_HOST;
   uint16_t port    = USE_TUNNEL?TUNNEL_PORT:LAN_PORT;
   bool useTLS = USE_TUNNEL;
-  String base = String(useTLS?"https://":"http://")+host;
-  if(!((useTLS && port==443) || (!useTLS && port==80))) base+=":"+String(port);
-  String url = base + INGEST_PATH;
-  Serial.println("POST " + url);
-  int attempts=0, backoff=600;
-  while(attempts<3){
-    attempts++; int code=-1;
-    if(useTLS){
-      WiFiClientSecure c; c.setInsecure();
-      HTTPClient h; if(!h.begin(c,url)){ Serial.println("Begin failed"); return false; }
-      h.addHeader("Content-Type","application/json");
-      h.addHeader("X-Device-Agent","ESP32");
-      h.setTimeout(8000);
-      code=h.POST(payload);
-      if(code>0){
-        Serial.printf("Attempt %d => %d\n", attempts, code);
-        String body=h.getString();
-        if(code>=200 && code<300){ Serial.println("OK: "+body); h.end(); return true; }
-        else Serial.println("Err: "+body);
-      } else Serial.printf("HTTPS err attempt %d (code=%d)\n", attempts, code);
-      h.end();
-    } else {
-      WiFiClient c; HTTPClient h;
-      if(!h.begin(c,url)){ Serial.println("Begin failed"); return false; }
-      h.addHeader("Content-Type","application/json");
-      h.addHeader("X-Device-Agent","ESP32-LAN");
-      h.setTimeout(6000);
-      code=h.POST(payload);
-      if(code>0){
-        Serial.printf("Attempt %d => %d\n", attempts, code);
-        String body=h.getString();
-        if(code>=200 && code<300){ Serial.println("OK: "+body); h.end(); return true; }
-        else Serial.println("Err: "+body);
-      } else Serial.printf("HTTP err attempt %d (code=%d)\n", attempts, code);
-      h.end();
-    }
-    delay(backoff); backoff*=2;
+  Serial.printf("POST %s://%s:%u%s\n", useTLS?"https":"http", host, port, INGEST_PATH);
+  unsigned long dnsMs=0, connMs=0;
+  if(!uplinkConnect(host, port, dnsMs, connMs)) return false;
+  bool reused = (dnsMs==0 && connMs==0);
+  http.setReuse(true);
+  if(!http.begin(uplinkClient(), host, port, INGEST_PATH, useTLS)){ Serial.println("Begin failed"); uplinkDrop(); return false; }
+  if(USE_MSGPACK){
+    http.addHeader("Content-Type","application/msgpack");
+    http.addHeader("X-Device-Key", DEVICE_API_KEY);
+  } else {
+    http.addHeader("Content-Type","application/json");
+  }
+  http.addHeader("X-Device-Agent", useTLS?"ESP32":"ESP32-LAN");
+  if(devCfg.etag[0]) http.addHeader("X-Config-ETag", devCfg.etag);
+  if(urgent) http.addHeader("X-Device-Urgent", "1");  // alert crossings are never shed
+  static const char* replyHeaders[] = { "Retry-After" };
+  http.collectHeaders(replyHeaders, 1);
+  http.setTimeout(useTLS?8000:6000);
+  unsigned long t0=millis();
+  uint32_t c0=perfBegin();
+  int code=http.POST((uint8_t*)body, len);
+  unsigned long reqMs=millis()-t0;
+  Serial.printf("[NET] %s dns=%lums %s=%lums req=%lums (connects=%lu reuses=%lu drops=%lu)\n",
+                reused?"reuse":"new", dnsMs, useTLS?"tcp+tls":"tcp", connMs, reqMs,
+                (unsigned long)netConnects, (unsigned long)netReuses, (unsigned long)netDrops);
+  if(code<=0){
+    Serial.printf("%s err (code=%d)\n", useTLS?"HTTPS":"HTTP", code);
+    uplinkDrop();
+    return false;
   }
-  Serial.println("All attempts failed.");
+  Serial.printf("POST => %d\n", code);
+  uplinkRetryHintMs = 0;
+  if(code==429 || code==503){
+    long s = http.header("Retry-After").toInt();  // seconds form only; the server sends no dates
+    if(s>0) uplinkRetryHintMs = (unsigned long)s*1000 < RETRY_AFTER_MAX_MS ? (unsigned long)s*1000 : RETRY_AFTER_MAX_MS;
+  }
+  RxSink sink; rxBuf[0]=0;
+  http.writeToStream(&sink);
+  perfEnd(PERF_HTTP, c0);  // request out, status + whole body back
+  http.end();  // keeps the socket open for reuse unless the server sent Connection: close
+  if(code>=200 && code<300){ Serial.printf("OK: %s\n", rxBuf); devCfgFromReply(rxBuf); paceFromReply(rxBuf); return true; }
+  if(code==503) paceFromReply(rxBuf);
+  Serial.printf("Err: %s\n", rxBuf);
   return false;
 }
 
-/* Setup */
-void setup(){
-  Serial.begin(115200); delay(150); Serial.println();
-  Serial.println("=== STEP 9 v2: Calibration + Smoothing ===");
-  Serial.println("Send 'R' in first 5s to force recalibration.");
-  pinMode(GAS_PIN, INPUT);
-  pinMode(PROX_TRIG_PIN, OUTPUT);
-  pinMode(PROX_ECHO_PIN, INPUT);
-  pinMode(PIR_PIN, INPUT);
-  dht.begin();
-  for(int i=0;i<3;i++){ dht.readTemperature(); dht.readHumidity(); delay(800); }
+/* MQTT uplink (USE_MQTT)
+   Clean session off, so the broker keeps the subscription and queued replies across
+   reconnects. publish() at QoS 1 returns once the broker acknowledged it; only then are the
+   records popped from the ring, as after a 2xx. */
+WiFiClientSecure mqttNet;
+MQTTClient mqtt(TX_BUF_SIZE + 128);
+char mqttUpTopic[64], mqttDownTopic[64];
+
+void mqttOnMessage(MQTTClient*, char topic[], char bytes[], int length){
+  size_t n = (size_t)length < RX_BUF_SIZE-1 ? (size_t)length : RX_BUF_SIZE-1;
+  memcpy(rxBuf, bytes, n); rxBuf[n]=0;
+  devCfgFromReply(rxBuf);
+  paceFromReply(rxBuf);
+}
 
-  // Serial override window
-  unsigned long start=millis(); bool serialForce=false;
-  while(millis()-start<5000){
-    if(Serial.available()){ char c=Serial.read(); if(c=='R'||c=='r'){ serialForce=true; break; } }
-    delay(50);
+bool mqttEnsure(){
+  if(mqtt.connected()){ netReuses++; return true; }
+  if(!mqttUpTopic[0]){
+    snprintf(mqttUpTopic, sizeof(mqttUpTopic), "%s/%s/up", MQTT_TOPIC_PREFIX, MQTT_CLIENT_ID);
+    snprintf(mqttDownTopic, sizeof(mqttDownTopic), "%s/%s/down", MQTT_TOPIC_PREFIX, MQTT_CLIENT_ID);
+    mqttNet.setInsecure();
+    mqtt.begin(MQTT_HOST, MQTT_PORT, mqttNet);
+    mqtt.setKeepAlive(60);
+    mqtt.setCleanSession(false);
+    mqtt.setTimeout(4000);
+    mqtt.onMessageAdvanced(mqttOnMessage);
   }
-  if(strcmp(WIFI_SSID,"Wokwi-GUEST")==0 && !USE_TUNNEL){
-    Serial.println("[WARN] For Wokwi enabling tunnel"); USE_TUNNEL=true;
+  unsigned long t0=millis();
+  uint32_t c0=perfBegin();
+  bool ok = mqtt.connect(MQTT_CLIENT_ID, MQTT_USER[0]?MQTT_USER:nullptr, MQTT_PASS[0]?MQTT_PASS:nullptr);
+  perfEnd(PERF_CONNECT, c0);
+  if(!ok){
+    Serial.printf("[MQTT] Connect to %s:%u failed (err=%d rc=%d) after %lums\n", MQTT_HOST, MQTT_PORT,
+                  mqtt.lastError(), mqtt.returnCode(), millis()-t0);
+    return false;
   }
+  netConnects++;
+  mqtt.subscribe(mqttDownTopic, 1);
+  Serial.printf("[MQTT] Connected %s:%u in %lums\n", MQTT_HOST, MQTT_PORT, millis()-t0);
+  return true;
+}
 
-  bool loaded = (!FORCE_RECAL && !serialForce) ? loadCalibration() : false;
-  connectWiFi(); syncTime();
-  if(loaded) Serial.println("[CAL] Using stored calibration.");
-  else { Serial.println("[CAL] Fresh calibration baseline phase."); captureGasMin(); }
+bool mqttPublish(const char* body, size_t len){
+  if(!mqttEnsure()) return false;
+  unsigned long t0=millis();
+  uint32_t c0=perfBegin();
+  bool ok = mqtt.publish(mqttUpTopic, body, (int)len, false, 1);
+  perfEnd(PERF_HTTP, c0);  // publish -> PUBACK counts as the request
+  Serial.printf("[MQTT] %u bytes %s in %lums\n", (unsigned)len, ok?"acked":"not acked", millis()-t0);
+  if(!ok){ mqtt.disconnect(); netDrops++; }
+  return ok;
 }
 
-/* Loop */
-void loop(){
-  handleSerialCommands();
-  connectWiFi();
-  unsigned long now=millis();
+unsigned long bootFirstPostMs = 0;
+
+// Drain one batch; records are only removed from the ring once the server accepted them
+bool flushReadings(bool urgent=false){
+  uint16_t used=0; bool meta=false;
+  size_t len = buildBatchPayload(devCfg.batchMax, used, meta);
+  if(!used) return true;
+  Serial.printf("Flush: %u of %u queued (dropped so far %lu)\n", used, ringCount, (unsigned long)ringDropped);
+  if(USE_MSGPACK){ Serial.printf("Payload: %u bytes msgpack\n", (unsigned)len); }
+  else { Serial.print("Payload: "); Serial.write((const uint8_t*)txBuf, len); Serial.println(); }
+  if(!(USE_MQTT ? mqttPublish(txBuf, len) : postPayload(txBuf, len, urgent))) return false;
+  ringPop(used);
+  if(meta) gasMetaSent=true;
+  if(!bootFirstPostMs){
+    bootFirstPostMs = millis();
+    Serial.printf("[BOOT] boot->first POST %lums (%s boot)\n", bootFirstPostMs, FAST_BOOT?"fast":"slow");
+  }
+  return true;
+}
 
+// Non-blocking Wi-Fi supervision for the running loop (connectWiFi() stays blocking for setup)
+unsigned long wifiAttemptAt = 0, wifiUpAt = 0;
+bool wifiWasUp = false;
+void wifiService(unsigned long now){
+  bool up = WiFi.status()==WL_CONNECTED;
+  if(up!=wifiWasUp){
+    wifiWasUp=up;
+    if(up){ wifiFastTry=false; wifiUpAt=now; Serial.print("WiFi IP: "); Serial.println(WiFi.localIP()); netCacheSave(); }
+    else {
+      // A drop says nothing about the cache: rejoin with it first, and only forget it if that
+      // attempt is not up within FAST_WIFI_TIMEOUT_MS
+      Serial.println("WiFi lost");
+      wifiAttemptAt=now;
+      wifiBegin();
+    }
+  }
+  if(!up && wifiFastTry && now - wifiAttemptAt >= FAST_WIFI_TIMEOUT_MS){
+    wifiAttemptAt=now;
+    wifiFallbackFromCache();
+  } else if(!up && now - wifiAttemptAt >= WIFI_RETRY_MS){
+    wifiAttemptAt=now;
+    Serial.println("WiFi reconnecting");
+    wifiBegin();
+  }
+}
+
+/* Sensor tasks
+   Each is given its period and returns the ms until it wants to run again (normally that
+   period); CHANNEL_SRC says which task feeds which channel, at what period. */
+// Power-managed modes poll less often so the idle stretches are long enough to sleep in
+unsigned long powerPoll(unsigned long activeMs){
+  return (POWER_MODE==POWER_ACTIVE || activeMs>=LP_POLL_MS) ? activeMs : LP_POLL_MS;
+}
+
+// One finished block average: MAX lock-in while calibrating, then the ppm EMA
+void gasUpdate(float raw, unsigned long now){
+  gasRawLast = raw;
   if(!gasMaxLocked && now - lastGasPoll >= GAS_POLL_MS){
     lastGasPoll=now;
-    float r=readGasBlockAvg();
-    considerLockMax(r);
+    considerLockMax(raw);
+  }
+  float ppmInstant = gasMaxLocked ? mapGasToPPM(raw) : NAN;
+  if(gasMaxLocked && !isnan(ppmInstant)) gasPpmEma = sensorFilters.gasStep(ppmInstant);
+}
+
+int  gasBlockIdx = 0;
+long gasBlockSum = 0;
+unsigned long taskGasRun(unsigned long now, unsigned long periodMs){
+  if(gasDma){
+    float mv;
+    if(gasDmaTake(mv)) gasUpdate(mv, now);
+    return periodMs;
+  }
+  // One ADC sample per run; SAMPLE_BLOCK samples SAMPLE_DELAY_MS apart make one block
+  gasBlockSum += analogReadMilliVolts(GAS_PIN);
+  if(++gasBlockIdx < SAMPLE_BLOCK) return SAMPLE_DELAY_MS;
+  float raw = (float)gasBlockSum/SAMPLE_BLOCK;
+  gasBlockIdx=0; gasBlockSum=0;
+  gasUpdate(raw, now);
+  // Calibration needs the full cadence to lock MAX; afterwards the block rate can relax
+  unsigned long period = gasMaxLocked ? powerPoll(periodMs) : periodMs;
+  return period - (SAMPLE_BLOCK-1)*SAMPLE_DELAY_MS;
+}
+
+// Per-run cost: one one-shot conversion, or picking up the finished DMA frames
+unsigned long taskGas(unsigned long now, unsigned long periodMs){
+  uint32_t c0 = perfBegin();
+  unsigned long next = taskGasRun(now, periodMs);
+  perfEnd(PERF_GAS, c0);
+  return next;
+}
+
+// Feeds both temp and humi
+unsigned long taskDht(unsigned long now, unsigned long periodMs){
+  uint32_t c0 = perfBegin();
+  float t = dht.readTemperature();
+  float h = dht.readHumidity();
+  perfEnd(PERF_DHT, c0);
+  // Outlier rejection: gross spikes, then the Hampel window
+  if(spikeAccept(t, lastGoodTemp, TEMP_SPIKE_MAX_DIFF)) dhtTemp=sensorFilters.temp.step(t);
+  if(spikeAccept(h, lastGoodHumi, HUMI_SPIKE_MAX_DIFF)) dhtHumi=sensorFilters.humi.step(h);
+  return periodMs;
+}
+
+unsigned long taskProx(unsigned long now, unsigned long periodMs){
+  uint32_t c0 = perfBegin();
+  float cm;
+  if(POWER_MODE==POWER_ACTIVE){
+    // Collect the ping fired last period, then fire the next one
+    cm = proxPending ? proxCollect() : NAN;
+    proxTrigger();
+  } else cm = proxRangeOnce();
+  if(!isnan(cm)) proxCm = sensorFilters.prox.step(cm);
+  perfEnd(PERF_PROX, c0);
+  return powerPoll(periodMs);
+}
+
+void motionEdge(int level, unsigned long atMs){
+  motionState = level;
+  emitRecordAt(SID_MOTION, MOTION_EDGE, (float)level, atMs);
+  channelArchive(sendState.ch[CHN_MOTION], (float)level, atMs);  // the edge is the motion point
+  if(level){ motionRises++; uplinkUrgent = true; }  // after the record is queued
+}
+
+unsigned long taskPir(unsigned long now, unsigned long periodMs){
+  unsigned long clk = pwrClockMs();
+  int64_t nowUs = esp_timer_get_time();
+  while(pirTail != pirHead){
+    PirEdge e = pirEdges[pirTail & (PIR_EDGE_CAP-1)];
+    pirTail = pirTail + 1;
+    if(e.level == motionState) continue;  // repeated level: an edge we already synthesized
+    motionEdge(e.level, clk - (unsigned long)((nowUs - e.us)/1000));
   }
+  // Edge that never reached the ring (light-sleep wake, ring full)
+  int level = readMotion();
+  if(level != motionState) motionEdge(level, clk);
+  return powerPoll(periodMs);
+}
+
+/* Alert pre-filter: a channel crossing into its alert range (the limits the server alerts on)
+   is sent at once and flushed without batching. It re-arms only once the value is back inside
+   by the channel's deadband, so noise sitting on a limit does not keep forcing sends. */
+RTC_DATA_ATTR uint8_t alertActive = 0;  // bit per channel
 
-  if(now - lastDhtPoll >= DHT_INTERVAL_MS){
-    lastDhtPoll=now;
-    float t = dht.readTemperature();
-    float h = dht.readHumidity();
-    // Outlier rejection
-    if(!isnan(t)){
-      if(isnan(lastGoodTemp) || fabs(t-lastGoodTemp) <= TEMP_SPIKE_MAX_DIFF) { dhtTemp=t; lastGoodTemp=t; }
+/* Battery: VBAT as a LiPo percentage */
+const float         BATT_DIVIDER   = 2.0f;
+const float         BATT_MV_EMPTY  = 3300.0f;
+const float         BATT_MV_FULL   = 4200.0f;
+const float         BATT_MV_ABSENT = 2500.0f;  // below this nothing is on the pin (USB power, no divider)
+const unsigned long BATT_POLL_MS   = 30000;
+float battPct = NAN;
+
+unsigned long taskBatt(unsigned long now, unsigned long periodMs){
+  float mv = BATT_DIVIDER * (gasDma ? battMvDma : (float)analogReadMilliVolts(BATT_PIN));
+  if(isnan(mv) || mv < BATT_MV_ABSENT) battPct = NAN;
+  else {
+    float pct = (mv - BATT_MV_EMPTY) * 100.0f / (BATT_MV_FULL - BATT_MV_EMPTY);
+    battPct = sensorFilters.batt.step(fminf(fmaxf(pct, 0.0f), 100.0f));
+  }
+  return periodMs;
+}
+
+typedef unsigned long (*TaskFn)(unsigned long now, unsigned long periodMs);
+
+/* Where each channel's value comes from, in Channel order (rows of CHANNELS)
+   value : the current filtered value, NAN = none yet
+   excess: > 0 = past the server's alert limit by that much, in the channel's domain
+           (decades for gas); nullptr = the channel has no alert
+   task  : the sensor task that feeds it, scheduled by schedBegin() every *periodMs (a devCfg
+           field when the server can retune it) with a deadlineMs budget; nullptr = fed by
+           another row's task (humi by the DHT read) */
+struct ChannelSource {
+  float (*value)();
+  float (*excess)(float v, const AlertLimits& a);
+  const char*          taskName;
+  TaskFn               task;
+  const unsigned long* periodMs;
+  unsigned long        deadlineMs;
+};
+
+const ChannelSource CHANNEL_SRC[CHN_COUNT] = {
+  { []{ return dhtTemp; },
+    [](float v, const AlertLimits& a){ return fmaxf(v - a.tempHigh, a.tempLow - v); },
+    "dht", taskDht, &devCfg.dhtMs, 60 },
+  { []{ return dhtHumi; },
+    [](float v, const AlertLimits& a){ return fmaxf(v - a.humiHigh, a.humiLow - v); },
+    nullptr, nullptr, nullptr, 0 },
+  { []{ return gasMaxLocked ? gasPpmEma : NAN; },
+    [](float v, const AlertLimits& a){ return (v>0 && a.gasHigh>0) ? log10f(v) - log10f(a.gasHigh) : -INFINITY; },
+    "gas", taskGas, &GAS_BLOCK_MS, SAMPLE_DELAY_MS },
+  { []{ return proxCm; },
+    [](float v, const AlertLimits& a){ return a.proxNear - v; },
+    "prox", taskProx, &devCfg.proxMs, 30 },
+  { []{ return (float)motionState; }, nullptr,
+    "pir", taskPir, &devCfg.pirMs, PIR_INTERVAL_MS },
+  { []{ return battPct; },
+    [](float v, const AlertLimits& a){ return a.battLow - v; },
+    "batt", taskBatt, &BATT_POLL_MS, 10 },
+};
+
+// Send policy: each channel decides on its own, and only its points are queued
+unsigned long taskDecide(unsigned long now, unsigned long periodMs){
+  char tags[3*CHN_COUNT+1]; uint8_t nt = 0;
+  bool urgent = false;
+  for(int c=0;c<CHN_COUNT;c++){
+    const ChannelSource& src = CHANNEL_SRC[c];
+    const ChannelPolicy& cp = devCfg.send.ch[c];
+    float v = channelValue(c, src.value());
+    float ex = (isnan(v) || !src.excess) ? -INFINITY : src.excess(v, devCfg.alerts);
+    bool alarm = ex > 0 && !(alertActive & (1<<c));
+    ChannelOut o;
+    if(alarm){ alertActive |= 1<<c; o = channelForce(cp, sendState.ch[c], v, now); }
+    else {
+      if(ex < -cp.deadband) alertActive &= ~(1<<c);
+      o = channelStep(cp, sendState.ch[c], v, now);
     }
-    if(!isnan(h)){
-      if(isnan(lastGoodHumi) || fabs(h-lastGoodHumi) <= HUMI_SPIKE_MAX_DIFF){ dhtHumi=h; lastGoodHumi=h; }
+    if(c==CHN_GAS && o.n && isnan(gasMetaRaw)) gasMetaRaw = gasRawLast;  // before the point is queued
+    for(uint8_t i=0;i<o.n;i++) emitRecordAt(CHANNELS[c].sid, 0, o.v[i], o.t[i]);
+    if(o.n){
+      tags[nt++] = o.heartbeat ? (char)(CHANNELS[c].tag+32) : CHANNELS[c].tag;
+      if(alarm){ tags[nt++] = '!'; urgent = true; }
+      tags[nt++] = ' ';
     }
   }
+  if(!nt) return powerPoll(periodMs);
+  tags[nt] = 0;
+  sendState.lastSend = now;
+  if(motionRises){ emitRecord(SID_MOTION, MOTION_COUNT, (float)motionRises); motionRises = 0; }
+  if(urgent) uplinkUrgent = true;  // after the records are queued
+  Serial.printf("Send: %s\n", tags);  // lower case = heartbeat, ! = alert crossing
+  if(WiFi.status()!=WL_CONNECTED) Serial.printf("Buffered: WiFi down (%u queued, %lu dropped)\n", ringCount, (unsigned long)ringDropped);
+  return powerPoll(periodMs);
+}
 
-  float raw = readGasBlockAvg();
-  float ppmInstant = gasMaxLocked ? mapGasToPPM(raw) : NAN;
-  if(gasMaxLocked && !isnan(ppmInstant)){
-    if(isnan(gasPpmEma)) gasPpmEma=ppmInstant;
-    else gasPpmEma += GAS_PPM_EMA_ALPHA * (ppmInstant - gasPpmEma);
-  }
-  float ppmSend = gasMaxLocked ? gasPpmEma : NAN;
-
-  bool firstSend = isnan(lastSentTemp) && isnan(lastSentHumi) && isnan(lastSentGasPPM);
-
-  bool tempChanged = (!isnan(dhtTemp) && !isnan(lastSentTemp) && fabs(dhtTemp-lastSentTemp)>=TEMP_DELTA_MIN) ||
-                     (firstSend && !isnan(dhtTemp));
-  bool humiChanged = (!isnan(dhtHumi) && !isnan(lastSentHumi) && fabs(dhtHumi-lastSentHumi)>=HUMI_DELTA_MIN) ||
-                     (firstSend && !isnan(dhtHumi));
-
-  float curRatio = linearRatio(raw);
-  float lastRatio = NAN;
-  if(gasMaxLocked && !isnan(lastSentGasPPM)){
-    float lastLog=log10(lastSentGasPPM);
-    float f=(lastLog - log10(PPM_MIN))/(log10(PPM_MAX)-log10(PPM_MIN));
-    if(f<0) f=0; if(f>1) f=1;
-    lastRatio=f;
-  }
-  bool gasChangedRatio = (gasMaxLocked && !isnan(curRatio) && !isnan(lastRatio) && fabs(curRatio-lastRatio) >= GAS_RATIO_DELTA_MIN);
-  bool gasChangedPpm   = (gasMaxLocked && !isnan(ppmSend) && !isnan(lastSentGasPPM) && fabs(ppmSend-lastSentGasPPM) >= GAS_PPM_DELTA_MIN);
-  bool gasChanged = gasChangedRatio || gasChangedPpm || (firstSend && gasMaxLocked && !isnan(ppmSend));
-
-  // Also consider proximity/motion deltas to trigger sends
-  float curProx = readProximityCm();
-  int   curMotion = readMotion();
-  bool proxChanged = (!isnan(curProx) && !isnan(lastSentProx) && fabs(curProx-lastSentProx) >= PROX_DELTA_MIN) ||
-                     (isnan(lastSentProx) && !isnan(curProx));
-  bool motionChanged = (curMotion != lastSentMotion);
-
-  bool anyChanged = tempChanged || humiChanged || gasChanged || proxChanged || motionChanged;
-  bool minGap = (now - lastPost) >= MIN_POST_INTERVAL;
-  bool forceDue = (now - lastPost) >= FORCE_INTERVAL;
-
-  if((anyChanged && minGap) || forceDue){
-  String payload = buildPayload(dhtTemp, dhtHumi, ppmSend, raw);
-    Serial.print("Trigger: ");
-    if(forceDue && !anyChanged) Serial.print("heartbeat ");
-    if(tempChanged) Serial.print("T ");
-    if(humiChanged) Serial.print("H ");
-    if(gasChanged) Serial.print("G ");
-  if(proxChanged) Serial.print("P ");
-  if(motionChanged) Serial.print("M ");
-    Serial.println();
-    Serial.println("Payload: " + payload);
-    if(WiFi.status()==WL_CONNECTED){
-      bool ok = postJSON(payload);
-      lastPost=now;
-      if(ok){
-        if(tempChanged && !isnan(dhtTemp)) lastSentTemp=dhtTemp;
-        if(humiChanged && !isnan(dhtHumi)) lastSentHumi=dhtHumi;
-        if(gasChanged && !isnan(ppmSend)){ lastSentGasPPM=ppmSend; if(!gasMetaSent) gasMetaSent=true; }
-    if(!isnan(curProx)) lastSentProx = curProx;
-    lastSentMotion = curMotion;
+unsigned long uplinkRetryAt = 0;
+unsigned long uplinkBackoff = UPLINK_BACKOFF_MIN_MS;
+// Flush / backoff decision for the uplink task; returns how long it may idle before re-checking
+unsigned long uplinkService(unsigned long now){
+  if(USE_MQTT && mqtt.connected()) mqtt.loop();  // keepalive, and replies -> mqttOnMessage()
+  if(ringCount==0 || WiFi.status()!=WL_CONNECTED) return UPLINK_POLL_MS;
+  if((long)(now - uplinkRetryAt) < 0) return UPLINK_POLL_MS;
+  // Motion and alert crossings skip batching (and the SNTP hold) so alerts are not held back
+  bool urgent = uplinkUrgent;
+  const BatchPolicy& batch = uplinkPaced ? uplinkPace : devCfg.batch;
+  if(!urgent && !batchFlushDue(batch, ringCount, now - lastFlush)) return UPLINK_POLL_MS;
+  // Fast boot: SNTP usually lands within a second of Wi-Fi; wait for it instead of
+  // sending readings the server would have to stamp with its own arrival time
+  if(!urgent && ringHasMono && !clockSynced() && now - wifiUpAt < SNTP_HOLD_MS) return UPLINK_POLL_MS;
+  lastFlush=now;
+  uplinkUrgent=false;
+  if(flushReadings(urgent)){
+    uplinkBackoff=UPLINK_BACKOFF_MIN_MS;
+    return ringCount>=batch.minRecords ? 0 : UPLINK_POLL_MS;  // keep draining a backlog
+  }
+  unsigned long wait = retryDelayMs(uplinkBackoff, uplinkRetryHintMs, esp_random());
+  uplinkRetryAt = millis() + wait;
+  Serial.printf("Uplink retry in %lums%s\n", wait, uplinkRetryHintMs?" (server hint)":"");
+  uplinkBackoff = uplinkBackoff*2 > UPLINK_BACKOFF_MAX_MS ? UPLINK_BACKOFF_MAX_MS : uplinkBackoff*2;
+  return UPLINK_POLL_MS;
+}
+
+unsigned long bootHeldSince = 0;
+unsigned long lastDiag = 0;
+// A config the uplink accepted from the server takes effect here, on the sampling core
+void devCfgApplyPending(){
+  if(!devCfgPending) return;
+  devCfg = devCfgIncoming;
+  devCfgPending = false;
+  devCfgSave();
+  Serial.printf("[CFG] Applied server config %s: dht=%lums prox=%lums pir=%lums batch=%u/%lums/%u\n",
+                devCfg.etag, devCfg.dhtMs, devCfg.proxMs, devCfg.pirMs, (unsigned)devCfg.batch.minRecords,
+                devCfg.batch.flushMs, (unsigned)devCfg.batchMax);
+}
+
+unsigned long taskService(unsigned long now, unsigned long periodMs){
+  handleSerialCommands();
+  devCfgApplyPending();
+  if(now - lastDiag >= DIAG_INTERVAL_MS){
+    lastDiag = now;
+    emitDiagnostics();
+  }
+  if(digitalRead(BOOT_BUTTON_PIN)==LOW){
+    if(!bootHeldSince) bootHeldSince = now ? now : 1;
+    else if(now - bootHeldSince >= BOOT_HOLD_MS){
+      Serial.println("[CAL] BOOT held; clearing cal and restarting for recalibration");
+      if(prefs.begin(NVS_NAMESPACE,false)){ prefs.clear(); prefs.end(); }
+      delay(100);
+      esp_restart();
+    }
+  } else bootHeldSince = 0;
+  if(now - lastJson >= PRINT_INTERVAL_MS){
+    lastJson = now;
+    char dbg[240];
+    snprintf(dbg,sizeof(dbg),"T=%.1f H=%.1f gas=%.1fppm prox=%.1fcm motion=%d pirlost=%lu queued=%u dropped=%lu qhw=%u/%u heap=%u min=%u maxblk=%u",
+             dhtTemp, dhtHumi, gasMaxLocked ? gasPpmEma : NAN, proxCm, motionState, (unsigned long)pirEdgesLost, ringCount,
+             (unsigned long)(ringDropped+queueDropped), (unsigned)queueHighWater, (unsigned)READING_QUEUE_LEN,
+             (unsigned)ESP.getFreeHeap(), (unsigned)ESP.getMinFreeHeap(), (unsigned)ESP.getMaxAllocHeap());
+    static char lastDbg[240];
+    if(strcmp(dbg,lastDbg)!=0){
+      Serial.printf("[DBG] %s\n", dbg);
+      strcpy(lastDbg,dbg);
+    }
+  }
+  return powerPoll(periodMs);
+}
+
+/* Power management
+   Light: idle stretches of the scheduler become esp_light_sleep_start() (timer + PIR level
+   wakeup) while the uplink has nothing pending; with an esp_pm build that supports automatic
+   light sleep the IDF does this itself and the explicit path stays off.
+   Deep: deepCycle() runs from setup() on every wake and ends in enterDeepSleep().
+   Awake/slept totals live in RTC memory so the duty cycle covers every wake, not one boot. */
+RTC_DATA_ATTR uint64_t pwrAwakeUs = 0, pwrSleptUs = 0;  // deep-mode totals across wakes
+RTC_DATA_ATTR int64_t  pwrSleepStartMs = 0;  // RTC wall clock when we went to sleep
+RTC_DATA_ATTR uint32_t pwrWakes = 0, pwrPostWakes = 0;
+RTC_DATA_ATTR uint64_t pwrWakeToPostMs = 0;  // sum over pwrPostWakes
+bool pwrAutoLightSleep = false;
+uint64_t lightSleptUs = 0;
+uint32_t lightSleeps = 0;
+volatile bool uplinkIdle = true;  // nothing the uplink could send right now
+
+
+void powerBeginLight(){
+  WiFi.setSleep(WIFI_PS_MAX_MODEM);  // radio sleeps between DTIM beacons
+#if CONFIG_PM_ENABLE
+#if ESP_IDF_VERSION_MAJOR >= 5
+  esp_pm_config_t pm = {};
+#else
+  esp_pm_config_esp32_t pm = {};
+#endif
+  pm.max_freq_mhz = 240; pm.min_freq_mhz = 80; pm.light_sleep_enable = true;
+  pwrAutoLightSleep = esp_pm_configure(&pm)==ESP_OK;
+#endif
+  Serial.printf("[PWR] light mode: %s light sleep, Wi-Fi modem sleep\n", pwrAutoLightSleep?"automatic":"explicit");
+}
+
+// Sleep through an idle stretch instead of blocking on the timer; false = not taken
+bool pwrLightSleep(unsigned long ms){
+  if(POWER_MODE!=POWER_LIGHT || pwrAutoLightSleep || ms<LIGHT_SLEEP_MIN_MS || !uplinkIdle) return false;
+  esp_sleep_enable_timer_wakeup((uint64_t)ms*1000ULL);
+  // Wake on whichever PIR level we are not at now, i.e. on the next edge
+  gpio_wakeup_enable((gpio_num_t)PIR_PIN, digitalRead(PIR_PIN) ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+  esp_sleep_enable_gpio_wakeup();
+  int64_t t0 = esp_timer_get_time();
+  esp_light_sleep_start();
+  lightSleptUs += esp_timer_get_time() - t0;
+  lightSleeps++;
+  gpio_wakeup_disable((gpio_num_t)PIR_PIN);
+  return true;
+}
+
+void printPowerStats(){
+  if(POWER_MODE==POWER_LIGHT){
+    if(pwrAutoLightSleep){ Serial.println("[PWR] light (automatic): duty not measured by the sketch"); return; }
+    uint64_t total = (uint64_t)millis()*1000ULL;
+    Serial.printf("[PWR] light: %lu sleeps, slept %.1fs of %.1fs, awake %.1f%%\n", (unsigned long)lightSleeps,
+                  lightSleptUs/1e6, total/1e6, total ? 100.0*(total-lightSleptUs)/total : 100.0);
+  } else if(POWER_MODE==POWER_DEEP){
+    uint64_t total = pwrAwakeUs + pwrSleptUs;
+    Serial.printf("[PWR] deep: wakes=%lu awake %.1f%% avg wake->post=%lums (%lu uploads)\n", (unsigned long)pwrWakes,
+                  total ? 100.0*pwrAwakeUs/total : 100.0,
+                  pwrPostWakes ? (unsigned long)(pwrWakeToPostMs/pwrPostWakes) : 0UL, (unsigned long)pwrPostWakes);
+  }
+}
+
+void enterDeepSleep(){
+  WiFi.disconnect(true);
+  WiFi.mode(WIFI_OFF);
+  unsigned long awake = millis();
+  pwrAwakeUs += (uint64_t)awake*1000ULL;
+  pwrClockBaseMs += awake;
+  Serial.printf("[PWR] wake #%lu awake %lums, %u queued; sleeping %lus\n", (unsigned long)pwrWakes, awake,
+                ringCount, (unsigned long)DEEP_SLEEP_S);
+  printPowerStats();
+  esp_sleep_enable_timer_wakeup((uint64_t)DEEP_SLEEP_S*1000000ULL);
+  // Already high: timer only, or the level wakeup would fire immediately
+  if(digitalRead(PIR_PIN)==LOW) esp_sleep_enable_ext0_wakeup((gpio_num_t)PIR_PIN, 1);
+  Serial.flush();
+  pwrSleepStartMs = rtcNowMs();
+  esp_deep_sleep_start();
+}
+
+// One deep-mode wake: sample everything once, run change detection, upload if worth it, sleep
+void deepCycle(){
+  esp_sleep_wakeup_cause_t cause = esp_sleep_get_wakeup_cause();
+  int64_t slept = rtcNowMs() - pwrSleepStartMs;
+  if(slept>0){ pwrSleptUs += (uint64_t)slept*1000ULL; pwrClockBaseMs += slept; }
+  pwrWakes++;
+  Serial.printf("[PWR] wake #%lu (%s)\n", (unsigned long)pwrWakes,
+                cause==ESP_SLEEP_WAKEUP_EXT0 ? "PIR" : cause==ESP_SLEEP_WAKEUP_TIMER ? "timer" : "other");
+  pinMode(GAS_PIN, INPUT);
+  gasAdcBegin();
+  proxBegin();
+  pinMode(PIR_PIN, INPUT);
+  dht.begin();  // stays powered through deep sleep: no warmup reads needed
+  readingQueue = xQueueCreate(READING_QUEUE_LEN, sizeof(Reading));
+
+  // Filter windows start empty each wake (one sample passes through); the gas EMA carries
+  // on from RTC memory
+  sensorFilters.gasEma.y[0] = gasPpmEma;
+  taskDht(0, devCfg.dhtMs);
+  gasUpdate(readGasBlockAvg(), millis());
+  proxCm = sensorFilters.prox.step(proxRangeOnce());
+  taskBatt(0, BATT_POLL_MS);
+  if(cause==ESP_SLEEP_WAKEUP_EXT0){ motionState = 1; motionRises = 1; }  // the wake was the edge
+  else motionState = readMotion();
+  taskDecide(pwrClockMs(), DECIDE_INTERVAL_MS);
+  Reading r;
+  while(xQueueReceive(readingQueue, &r, 0)==pdTRUE) ringPush(r);
+
+  if(ringCount>=DEEP_BATCH_RECORDS || (cause==ESP_SLEEP_WAKEUP_EXT0 && ringCount)){
+    netCacheLoad();
+    if(connectWiFi(DEEP_WIFI_TIMEOUT_MS)){
+      if(!timeSynced) syncTime();
+      ringFixupTimes();
+      unsigned long postedAt=0;
+      for(int i=0;i<4 && ringCount;i++){
+        if(!flushReadings(cause==ESP_SLEEP_WAKEUP_EXT0)) break;
+        if(!postedAt) postedAt=millis();
+      }
+      if(postedAt){
+        pwrPostWakes++; pwrWakeToPostMs += postedAt;
+        Serial.printf("[PWR] wake->post %lums\n", postedAt);
       }
+      if(USE_MQTT) mqtt.loop();  // a reply not in yet stays queued in the session for the next wake
+      devCfgApplyPending();
     } else {
-      Serial.println("Skip POST: WiFi down");
-      lastPost=now;
+      Serial.println("[PWR] WiFi timeout; readings stay queued for the next wake");
     }
   }
+  enterDeepSleep();
+}
 
-  if(now - lastJson >= PRINT_INTERVAL_MS){
-    lastJson = now;
-    String dbg = buildPayload(dhtTemp, dhtHumi, ppmSend, raw);
-    static String lastDbg;
-    if(dbg != lastDbg){
-      Serial.println("[DBG] " + dbg);
-      lastDbg = dbg;
+/* Scheduler
+   Cooperative: every task has a period and a deadline (release -> finish budget). After a
+   pass, a one-shot esp_timer is armed for the earliest next release and the loop task blocks
+   in ulTaskNotifyTake() until it fires, so the CPU idles between samples instead of spinning
+   in delay(). A task that falls more than a period behind skips ahead rather than bursting.
+   The sensor tasks come from CHANNEL_SRC; a pass runs released tasks tightest deadline first. */
+struct SchedTask {
+  const char*          name;
+  unsigned long        deadlineMs;
+  TaskFn               run;
+  const unsigned long* periodMs;
+  unsigned long        nextRelease;
+  uint32_t             runs, misses;
+  unsigned long        worstMs;
+};
+
+SchedTask schedTasks[CHN_COUNT + 2];  // sensor tasks, decide, service
+size_t    schedTaskCount = 0;
+
+void schedAdd(const char* name, unsigned long deadlineMs, TaskFn run, const unsigned long* periodMs){
+  size_t i = schedTaskCount++;
+  for(; i>0 && schedTasks[i-1].deadlineMs > deadlineMs; i--) schedTasks[i] = schedTasks[i-1];
+  SchedTask t = {};
+  t.name = name; t.deadlineMs = deadlineMs; t.run = run; t.periodMs = periodMs;
+  schedTasks[i] = t;
+}
+
+esp_timer_handle_t schedTimer = nullptr;
+TaskHandle_t       schedWaiter = nullptr;
+
+void schedTimerCb(void*){ if(schedWaiter) xTaskNotifyGive(schedWaiter); }
+
+void schedBegin(){
+  schedWaiter = xTaskGetCurrentTaskHandle();
+  esp_timer_create_args_t args = {};
+  args.callback = &schedTimerCb;
+  args.name = "sched";
+  if(esp_timer_create(&args, &schedTimer)!=ESP_OK) Serial.println("[SCHED] esp_timer_create failed");
+  schedTaskCount = 0;
+  for(int c=0;c<CHN_COUNT;c++){
+    const ChannelSource& src = CHANNEL_SRC[c];
+    if(src.task) schedAdd(src.taskName, src.deadlineMs, src.task, src.periodMs);
+  }
+  schedAdd("decide",  DECIDE_INTERVAL_MS, taskDecide,  &DECIDE_INTERVAL_MS);
+  schedAdd("service", 100,                taskService, &SERVICE_INTERVAL_MS);
+  unsigned long now=millis();
+  for(size_t i=0;i<schedTaskCount;i++) schedTasks[i].nextRelease=now;
+}
+
+// Run every released task once; returns ms until the earliest next release
+unsigned long schedRunDue(){
+  unsigned long wait = 1000;  // upper bound on one idle stretch
+  for(size_t i=0;i<schedTaskCount;i++){
+    SchedTask& t = schedTasks[i];
+    unsigned long now=millis();
+    if((long)(now - t.nextRelease) >= 0){
+      unsigned long release = t.nextRelease;
+      perfAddUs(PERF_JITTER, (uint32_t)(micros() - release*1000UL));  // release -> start lateness
+      unsigned long next = t.run(now, *t.periodMs);
+      unsigned long end = millis();
+      unsigned long took = end - release;
+      t.runs++;
+      if(took > t.worstMs) t.worstMs = took;
+      if(took > t.deadlineMs) t.misses++;
+      t.nextRelease = release + next;
+      if((long)(end - t.nextRelease) > 0) t.nextRelease = end + next;
+      now = end;
+    }
+    unsigned long until = (long)(t.nextRelease - now) > 0 ? t.nextRelease - now : 0;
+    if(until < wait) wait = until;
+  }
+  return wait;
+}
+
+void schedWait(unsigned long ms){
+  if(ms==0) return;
+  if(pwrLightSleep(ms)) return;
+  esp_timer_stop(schedTimer);  // may not be running; harmless
+  esp_timer_start_once(schedTimer, (uint64_t)ms*1000ULL);
+  ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ms+20));  // timeout is only a safety net
+}
+
+void printSchedStats(){
+  Serial.println("[SCHED] task     runs  misses worst(ms) deadline(ms)");
+  for(size_t i=0;i<schedTaskCount;i++){
+    const SchedTask& t = schedTasks[i];
+    Serial.printf("[SCHED] %-8s %6lu %6lu %9lu %12lu\n", t.name, (unsigned long)t.runs,
+                  (unsigned long)t.misses, t.worstMs, t.deadlineMs);
+  }
+  Serial.printf("[SCHED] queue hw=%u/%u now=%u dropped=%lu | ring %u/%u dropped=%lu\n",
+                (unsigned)queueHighWater, (unsigned)READING_QUEUE_LEN,
+                readingQueue ? (unsigned)uxQueueMessagesWaiting(readingQueue) : 0u, (unsigned long)queueDropped,
+                ringCount, (unsigned)RING_CAPACITY, (unsigned long)ringDropped);
+  Serial.printf("[SCHED] stack free (words): sampling=%u uplink=%u\n",
+                samplingTaskHandle ? (unsigned)uxTaskGetStackHighWaterMark(samplingTaskHandle) : 0u,
+                uplinkTaskHandle ? (unsigned)uxTaskGetStackHighWaterMark(uplinkTaskHandle) : 0u);
+  printPowerStats();
+}
+
+/* Pipeline tasks */
+void samplingTask(void*){
+  schedBegin();
+  for(;;) schedWait(schedRunDue());
+}
+
+// Moves readings from the queue into the ring, then flushes on its own cadence. A POST here can
+// block for seconds without stalling sampling on the other core.
+void uplinkTask(void*){
+  unsigned long idleMs = UPLINK_POLL_MS;
+  for(;;){
+    Reading r;
+    if(xQueueReceive(readingQueue, &r, pdMS_TO_TICKS(idleMs))==pdTRUE){
+      do { ringPush(r); } while(xQueueReceive(readingQueue, &r, 0)==pdTRUE);
     }
+    unsigned long now=millis();
+    wifiService(now);
+    ringFixupTimes();
+    idleMs = uplinkService(now);
+    uplinkIdle = ringCount==0 || WiFi.status()!=WL_CONNECTED;
+    // Deep mode, first boot: once calibrated and the first snapshot is out (or Wi-Fi is
+    // unavailable -- the ring is kept in RTC memory), hand over to the wake/sleep cycle
+    if(POWER_MODE==POWER_DEEP && gasMaxLocked && sendState.lastSend && uplinkIdle &&
+       uxQueueMessagesWaiting(readingQueue)==0) enterDeepSleep();
   }
+}
 
-  delay(40);
-}
\ No newline at end of file
+/* Setup */
+void setup(){
+  Serial.begin(115200);
+  if(strcmp(WIFI_SSID,"Wokwi-GUEST")==0 && !USE_TUNNEL){
+    Serial.println("[WARN] For Wokwi enabling tunnel"); USE_TUNNEL=true;
+  }
+  if(POWER_MODE==POWER_DEEP && esp_reset_reason()==ESP_RST_DEEPSLEEP && gasMaxLocked){
+    deepCycle();  // does not return
+  }
+  Serial.println();
+  Serial.println("=== STEP 9 v2: Calibration + Smoothing ===");
+  cpuMHz = ESP.getCpuFreqMHz();
+  pinMode(GAS_PIN, INPUT);
+  gasAdcBegin();
+  proxBegin();
+  pirBegin();
+  pinMode(BOOT_BUTTON_PIN, INPUT_PULLUP);
+  dht.begin();
+  bool serialForce=false;
+  if(FAST_BOOT){
+    // Wi-Fi + SNTP come up in the background while calibration loads and sampling starts.
+    // The DHT's first read comes from the scheduler; an early NaN is simply skipped.
+    netCacheLoad();
+    wifiBegin();
+    sntpStart();
+  } else {
+    Serial.println("Send 'R' in first 5s to force recalibration.");
+    for(int i=0;i<3;i++){ dht.readTemperature(); dht.readHumidity(); delay(800); }
+    // Serial override window
+    unsigned long start=millis();
+    while(millis()-start<5000){
+      if(Serial.available()){ char c=Serial.read(); if(c=='R'||c=='r'){ serialForce=true; break; } }
+      delay(50);
+    }
+  }
+
+  devCfgLoad();
+  bool loaded = (!FORCE_RECAL && !serialForce) ? loadCalibration() : false;
+  if(!FAST_BOOT){ connectWiFi(15000); syncTime(); }
+  if(loaded) Serial.println("[CAL] Using stored calibration.");
+  else { Serial.println("[CAL] Fresh calibration baseline phase."); captureGasMin(); }
+  if(POWER_MODE==POWER_LIGHT) powerBeginLight();
+  wifiWasUp = WiFi.status()==WL_CONNECTED;
+  wifiAttemptAt = millis();
+  readingQueue = xQueueCreate(READING_QUEUE_LEN, sizeof(Reading));
+  xTaskCreatePinnedToCore(uplinkTask,   "uplink",   UPLINK_STACK,   nullptr, 2, &uplinkTaskHandle,   UPLINK_CORE);
+  xTaskCreatePinnedToCore(samplingTask, "sampling", SAMPLING_STACK, nullptr, 3, &samplingTaskHandle, SAMPLING_CORE);
+}
+
+/* Loop */
+void loop(){
+  vTaskDelete(NULL);  // all work runs in samplingTask / uplinkTask
+}